@@ -67,6 +67,9 @@ bool is_alnum_char(const char *c)
 #ifdef ENABLE_UTF8
 	wchar_t wc;
 
+	if ((signed char)*c >= 0)
+		return isalnum((unsigned char)*c);
+
 	if (mbtowide(&wc, c) < 0)
 		return FALSE;
 
@@ -112,6 +115,9 @@ bool is_punct_char(const char *c)
 #ifdef ENABLE_UTF8
 	wchar_t wc;
 
+	if ((signed char)*c >= 0)
+		return ispunct((unsigned char)*c);
+
 	if (mbtowide(&wc, c) < 0)
 		return FALSE;
 
@@ -136,7 +142,13 @@ bool is_word_char(const char *c, bool allow_punct)
 
 	if (word_chars != NULL && *word_chars != '\0') {
 		char symbol[MAXCHARLEN + 1];
-		int symlen = collect_char(c, symbol);
+		int symlen;
+
+		/* A single-byte character can be looked up directly. */
+		if ((signed char)*c > 0)
+			return (strchr(word_chars, *c) != NULL);
+
+		symlen = collect_char(c, symbol);
 
 		symbol[symlen] = '\0';
 		return (strstr(word_chars, symbol) != NULL);
@@ -303,13 +315,33 @@ size_t mbstrlen(const char *pointer)
 	size_t count = 0;
 
 	while (*pointer != '\0') {
-		pointer += char_length(pointer);
+		/* An ASCII character is a single byte, so it needs no decoding. */
+		if ((signed char)*pointer > 0)
+			pointer++;
+		else
+			pointer += char_length(pointer);
 		count++;
 	}
 
 	return count;
 }
 
+/* Return the length of the run of printable ASCII characters at the start of
+ * the given string, looking at no more than maxlen bytes.  As each of these
+ * characters is a single byte that takes a single column, the callers can
+ * step over such a run (the bulk of most text) without decoding anything. */
+size_t ascii_run(const char *string, size_t maxlen)
+{
+	const char *pointer = string;
+
+	while (maxlen > 0 && 0x1F < *pointer && *pointer < DEL_CODE) {
+		pointer++;
+		maxlen--;
+	}
+
+	return (pointer - string);
+}
+
 /* Return the length (in bytes) of the character at the start of the
  * given string, and return a copy of this character in *thechar. */
 int collect_char(const char *string, char *thechar)
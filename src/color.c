@@ -28,9 +28,12 @@
 #include <magic.h>
 #endif
 #include <string.h>
+#include <time.h>
 
 static bool defaults_allowed = FALSE;
 		/* Whether ncurses accepts -1 to mean "default color". */
+static profiletype *profiles = NULL;
+		/* The tallies of all coloring rules, when profiling. */
 
 /* Initialize the color pairs for nano's interface. */
 void set_interface_colorpairs(void)
@@ -119,9 +122,25 @@ void prepare_palette(void)
  * the list starting at head.  Return TRUE upon success. */
 bool found_in_list(regexlisttype *head, const char *shibboleth)
 {
-	for (regexlisttype *item = head; item != NULL; item = item->next)
-		if (regexec(item->one_rgx, shibboleth, 0, NULL, 0) == 0)
+	for (regexlisttype *item = head; item != NULL; item = item->next) {
+		/* A regex taken from the syntax cache gets compiled upon first use. */
+		if (item->expression != NULL) {
+			item->one_rgx = nmalloc(sizeof(regex_t));
+
+			if (regcomp(item->one_rgx, item->expression,
+								NANO_REG_EXTENDED | REG_NOSUB) != 0) {
+				free(item->one_rgx);
+				item->one_rgx = NULL;
+			}
+
+			free(item->expression);
+			item->expression = NULL;
+		}
+
+		if (item->one_rgx != NULL &&
+					regexec(item->one_rgx, shibboleth, 0, NULL, 0) == 0)
 			return TRUE;
+	}
 
 	return FALSE;
 }
@@ -222,6 +241,34 @@ void find_and_prime_applicable_syntax(void)
 	}
 
 	openfile->syntax = sntx;
+
+	/* A different syntax may have a different number of multiline regexes. */
+	openfile->checkroom = 0;
+	openfile->checkvalid = 0;
+}
+
+/* Return the stored state of the given multiline regex for the given line,
+ * or zero when it has not been determined. */
+short multistate(const linestruct *line, const colortype *ink)
+{
+	if (ink->id >= MAX_MULTIS)
+		return 0;
+
+	return (line->multidata >> (ink->id * MULTI_WIDTH)) & ((1 << MULTI_WIDTH) - 1);
+}
+
+/* Store the given state of the given multiline regex for the given line.
+ * (When there are too many multiline regexes, the state is not stored,
+ * and the line will simply be examined afresh each time.) */
+void set_multistate(linestruct *line, const colortype *ink, short state)
+{
+	int shift = ink->id * MULTI_WIDTH;
+
+	if (ink->id >= MAX_MULTIS)
+		return;
+
+	line->multidata &= ~((unsigned long long)((1 << MULTI_WIDTH) - 1) << shift);
+	line->multidata |= (unsigned long long)state << shift;
 }
 
 /* Determine whether the matches of multiline regexes are still the same,
@@ -237,35 +284,40 @@ void check_the_multis(linestruct *line)
 	if (openfile->syntax == NULL || openfile->syntax->nmultis == 0)
 		return;
 
-	if (line->multidata == NULL) {
-		refresh_needed = TRUE;
-		return;
-	}
-
 	for (ink = openfile->syntax->color; ink != NULL; ink = ink->next) {
+		short state;
+
 		/* If it's not a multiline regex, skip. */
 		if (ink->end == NULL)
 			continue;
 
+		state = multistate(line, ink);
+
+		/* If the state is unknown, things will have to be repainted. */
+		if (state == 0) {
+			refresh_needed = TRUE;
+			return;
+		}
+
 		astart = (regexec(ink->start, line->data, 1, &startmatch, 0) == 0);
 		afterstart = line->data + (astart ? startmatch.rm_eo : 0);
 		anend = (regexec(ink->end, afterstart, 1, &endmatch, 0) == 0);
 
 		/* Check whether the multidata still matches the current situation. */
-		if (line->multidata[ink->id] == NOTHING) {
+		if (state == NOTHING) {
 			if (!astart)
 				continue;
-		} else if (line->multidata[ink->id] & (WHOLELINE|WOULDBE)) {
+		} else if (state == WHOLELINE || state == WOULDBE) {
 			if (!astart && !anend)
 				continue;
-		} else if (line->multidata[ink->id] == JUSTONTHIS) {
+		} else if (state == JUSTONTHIS) {
 			if (astart && anend && regexec(ink->start, line->data + endmatch.rm_eo,
 														1, &startmatch, 0) != 0)
 				continue;
-		} else if (line->multidata[ink->id] == STARTSHERE) {
+		} else if (state == STARTSHERE) {
 			if (astart && !anend)
 				continue;
-		} else if (line->multidata[ink->id] == ENDSHERE) {
+		} else if (state == ENDSHERE) {
 			if (!astart && anend)
 				continue;
 		}
@@ -276,6 +328,140 @@ void check_the_multis(linestruct *line)
 	}
 }
 
+/* Return TRUE when the given multiline regex has an unpaired start match
+ * at the end of the given line, knowing whether it had one at its start. */
+bool still_unpaired(const colortype *ink, const linestruct *line, bool unpaired)
+{
+	regmatch_t startmatch, endmatch;
+	int index = 0;
+
+	/* An open region gets closed by the first end match, if any. */
+	if (unpaired) {
+		if (regexec(ink->end, line->data, 1, &endmatch, 0) != 0)
+			return TRUE;
+		index = endmatch.rm_eo;
+	}
+
+	/* Pair each subsequent start match with an end match after it. */
+	while (regexec(ink->start, line->data + index, 1, &startmatch,
+								(index == 0) ? 0 : REG_NOTBOL) == 0) {
+		index += startmatch.rm_eo;
+
+		if (regexec(ink->end, line->data + index, 1, &endmatch,
+								(index == 0) ? 0 : REG_NOTBOL) != 0)
+			return TRUE;
+
+		index += endmatch.rm_eo;
+
+		/* If the total match has zero length, force an advance. */
+		if (startmatch.rm_eo - startmatch.rm_so + endmatch.rm_eo == 0) {
+			if (line->data[index] == '\0')
+				break;
+			index = step_right(line->data, index);
+		}
+	}
+
+	return FALSE;
+}
+
+/* Return TRUE when the given multiline regex has an unpaired start match
+ * before the given line, which must be a checkpoint line.  Checkpoints
+ * that are missing or outdated get computed by scanning forward from
+ * the last valid one, so each line is scanned at most once per edit. */
+bool unpaired_at_checkpoint(const colortype *varnish, const linestruct *line)
+{
+	size_t wanted = (line->lineno - 1) / CHECKPOINT_STRIDE;
+	size_t nmultis = openfile->syntax->nmultis;
+	const linestruct *scanner = line;
+
+	/* At the top of the buffer, no start match can be pending. */
+	if (wanted == 0)
+		return FALSE;
+
+	if (wanted > openfile->checkroom) {
+		openfile->checkroom = wanted + openfile->filebot->lineno / CHECKPOINT_STRIDE;
+		openfile->checkpoints = nrealloc(openfile->checkpoints,
+								openfile->checkroom * nmultis * sizeof(bool));
+	}
+
+	/* Back up to the last checkpoint line that is still up to date. */
+	while (scanner->lineno > openfile->checkvalid * CHECKPOINT_STRIDE + 1)
+		scanner = scanner->prev;
+
+	/* Compute the missing checkpoints, one stride at a time. */
+	while (openfile->checkvalid < wanted) {
+		size_t base = openfile->checkvalid;
+
+		for (const colortype *ink = openfile->syntax->color; ink; ink = ink->next) {
+			const linestruct *item = scanner;
+			bool unpaired;
+
+			if (ink->end == NULL)
+				continue;
+
+			unpaired = (base == 0) ? FALSE :
+								openfile->checkpoints[(base - 1) * nmultis + ink->id];
+
+			for (int count = 0; count < CHECKPOINT_STRIDE; count++) {
+				unpaired = still_unpaired(ink, item, unpaired);
+				item = item->next;
+			}
+
+			openfile->checkpoints[base * nmultis + ink->id] = unpaired;
+		}
+
+		for (int count = 0; count < CHECKPOINT_STRIDE; count++)
+			scanner = scanner->next;
+
+		openfile->checkvalid++;
+	}
+
+	return openfile->checkpoints[(wanted - 1) * nmultis + varnish->id];
+}
+
+/* Mark the checkpoints on and after the given line as outdated, because
+ * the state of the multiline regexes there may have changed. */
+void discard_checkpoints_from(const linestruct *line)
+{
+	size_t keep = (line->lineno < 2) ? 0 : (line->lineno - 2) / CHECKPOINT_STRIDE;
+
+	if (keep < openfile->checkvalid)
+		openfile->checkvalid = keep;
+}
+
+/* Return TRUE when the coloring of the given line (when drawn at the top of
+ * the edit window or not) depends just on the line itself and on the state
+ * of the preceding line, and not on what comes before or after. */
+bool colored_by_itself(const linestruct *line, bool at_top)
+{
+	if (openfile->syntax == NULL || openfile->syntax->nmultis == 0 ||
+							ISSET(NO_SYNTAX))
+		return TRUE;
+
+	/* At the top, or when not all states are stored, there is backtracking. */
+	if (at_top || openfile->syntax->nmultis > MAX_MULTIS)
+		return FALSE;
+
+	for (const colortype *ink = openfile->syntax->color; ink != NULL; ink = ink->next) {
+		short state;
+
+		if (ink->end == NULL)
+			continue;
+
+		state = multistate(line, ink);
+
+		/* When an end was sought on later lines, those lines matter too. */
+		if (state == STARTSHERE || state == WOULDBE || state == 0)
+			return FALSE;
+
+		/* When the state of the preceding line was unknown, earlier lines matter. */
+		if (line->prev != NULL && multistate(line->prev, ink) == 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 /* Precalculate the multi-line start and end regex info so we can
  * speed up rendering (with any hope at all...). */
 void precalc_multicolorinfo(void)
@@ -284,30 +470,25 @@ void precalc_multicolorinfo(void)
 	regmatch_t startmatch, endmatch;
 	linestruct *line, *tailline;
 
+	/* The checkpoints will have to be recomputed too. */
+	openfile->checkvalid = 0;
+
 	if (!openfile->syntax || openfile->syntax->nmultis == 0 || ISSET(NO_SYNTAX))
 		return;
 
-//#define TIMEPRECALC  123
-#ifdef TIMEPRECALC
-#include <time.h>
-	clock_t start = clock();
-#endif
-
-	/* For each line, allocate cache space for the multiline-regex info. */
-	for (line = openfile->filetop; line != NULL; line = line->next)
-		if (!line->multidata)
-			line->multidata = nmalloc(openfile->syntax->nmultis * sizeof(short));
-
 	for (ink = openfile->syntax->color; ink != NULL; ink = ink->next) {
-		/* If this is not a multi-line regex, skip it. */
-		if (ink->end == NULL)
+		/* If this is not a multi-line regex, or its state cannot be stored, skip. */
+		if (ink->end == NULL || ink->id >= MAX_MULTIS)
 			continue;
 
 		for (line = openfile->filetop; line != NULL; line = line->next) {
 			int index = 0;
 
+			if (colorprofile != NULL)
+				time_rule(ink, PRECALCULATING);
+
 			/* Assume nothing applies until proven otherwise below. */
-			line->multidata[ink->id] = NOTHING;
+			set_multistate(line, ink, NOTHING);
 
 			/* When the line contains a start match, look for an end,
 			 * and if found, mark all the lines that are affected. */
@@ -320,7 +501,7 @@ void precalc_multicolorinfo(void)
 				 * but continue looking for other starts after it. */
 				if (regexec(ink->end, line->data + index, 1, &endmatch,
 										(index == 0) ? 0 : REG_NOTBOL) == 0) {
-					line->multidata[ink->id] = JUSTONTHIS;
+					set_multistate(line, ink, JUSTONTHIS);
 
 					index += endmatch.rm_eo;
 
@@ -345,19 +526,19 @@ void precalc_multicolorinfo(void)
 				/* When there is no end match, mark relevant lines as such. */
 				if (tailline == NULL) {
 					for (; line->next != NULL; line = line->next)
-						line->multidata[ink->id] = WOULDBE;
-					line->multidata[ink->id] = WOULDBE;
+						set_multistate(line, ink, WOULDBE);
+					set_multistate(line, ink, WOULDBE);
 					break;
 				}
 
 				/* We found it, we found it, la lala lala.  Mark the lines. */
-				line->multidata[ink->id] = STARTSHERE;
+				set_multistate(line, ink, STARTSHERE);
 
 				// Note that this also advances the line in the main loop.
 				for (line = line->next; line != tailline; line = line->next)
-					line->multidata[ink->id] = WHOLELINE;
+					set_multistate(line, ink, WHOLELINE);
 
-				tailline->multidata[ink->id] = ENDSHERE;
+				set_multistate(tailline, ink, ENDSHERE);
 
 				/* Look for a possible new start after the end match. */
 				index = endmatch.rm_eo;
@@ -365,10 +546,111 @@ void precalc_multicolorinfo(void)
 		}
 	}
 
-#ifdef TIMEPRECALC
-	statusline(INFO, "Precalculation: %.1f ms", 1000 * (double)(clock() - start) / CLOCKS_PER_SEC);
-	napms(1200);
-#endif
+	if (colorprofile != NULL)
+		time_rule(NULL, PRECALCULATING);
+}
+
+/* Allocate a tally for a rule of the given syntax that was defined at the
+ * given place, and add it to the list of tallies. */
+profiletype *make_profile(const char *syntaxname, const char *filename,
+							size_t lineno, const char *regex)
+{
+	profiletype *tally = nmalloc(sizeof(profiletype));
+
+	tally->syntaxname = syntaxname;
+	tally->filename = copy_of(filename);
+	tally->lineno = lineno;
+	tally->regex = copy_of(regex);
+	tally->nanoseconds[PRECALCULATING] = 0;
+	tally->nanoseconds[PAINTING] = 0;
+	tally->applied[PRECALCULATING] = 0;
+	tally->applied[PAINTING] = 0;
+
+	tally->next = profiles;
+	profiles = tally;
+
+	return tally;
+}
+
+/* Charge the time since the previous call to the rule that was timed then,
+ * and start timing the given rule (when not NULL) in the given phase. */
+void time_rule(const colortype *ink, int phase)
+{
+	static profiletype *timed = NULL;
+	static int timed_phase;
+	static struct timespec since;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (timed != NULL)
+		timed->nanoseconds[timed_phase] += (now.tv_sec - since.tv_sec) * 1000000000LL +
+												now.tv_nsec - since.tv_nsec;
+
+	timed = (ink == NULL) ? NULL : ink->profile;
+	timed_phase = phase;
+	since = now;
+
+	if (timed != NULL)
+		timed->applied[phase]++;
+}
+
+/* Order two tallies by decreasing total time. */
+int slowest_first(const void *one, const void *two)
+{
+	const profiletype *a = *(const profiletype **)one;
+	const profiletype *b = *(const profiletype **)two;
+	unsigned long long first = a->nanoseconds[PRECALCULATING] + a->nanoseconds[PAINTING];
+	unsigned long long second = b->nanoseconds[PRECALCULATING] + b->nanoseconds[PAINTING];
+
+	return (first < second) ? 1 : (first > second) ? -1 : 0;
+}
+
+/* Write the time spent on each coloring rule so far to the profile file,
+ * slowest rule first.  Return FALSE when the file could not be written. */
+bool write_color_profile(void)
+{
+	profiletype **sorted;
+	size_t count = 0, index = 0;
+	char *fullname;
+	FILE *stream;
+
+	if (colorprofile == NULL)
+		return TRUE;
+
+	fullname = real_dir_from_tilde(colorprofile);
+	stream = fopen(fullname, "wb");
+	free(fullname);
+
+	if (stream == NULL)
+		return FALSE;
+
+	for (profiletype *tally = profiles; tally != NULL; tally = tally->next)
+		count++;
+
+	sorted = nmalloc((count + 1) * sizeof(profiletype *));
+
+	for (profiletype *tally = profiles; tally != NULL; tally = tally->next)
+		sorted[index++] = tally;
+
+	qsort(sorted, count, sizeof(profiletype *), slowest_first);
+
+	fprintf(stream, "%10s %10s %10s %9s %9s  %s\n", "total ms", "precalc",
+						"painting", "lines", "rows", "syntax, place, and regex");
+
+	for (index = 0; index < count; index++) {
+		profiletype *tally = sorted[index];
+
+		fprintf(stream, "%10.3f %10.3f %10.3f %9zu %9zu  %s  %s:%zu  \"%s\"\n",
+				(tally->nanoseconds[PRECALCULATING] + tally->nanoseconds[PAINTING]) / 1e6,
+				tally->nanoseconds[PRECALCULATING] / 1e6, tally->nanoseconds[PAINTING] / 1e6,
+				tally->applied[PRECALCULATING], tally->applied[PAINTING],
+				tally->syntaxname, tally->filename, tally->lineno, tally->regex);
+	}
+
+	free(sorted);
+
+	return (fclose(stream) == 0);
 }
 
 #endif /* ENABLE_COLOR */
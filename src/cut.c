@@ -49,6 +49,8 @@ void do_deletion(undo_type action)
 					&openfile->current->data[openfile->current_x + charlen],
 					line_len - charlen + 1);
 #ifndef NANO_TINY
+		trim_layout_of(openfile->current, openfile->current_x);
+
 		/* When softwrapping, a changed number of chunks requires a refresh. */
 		if (ISSET(SOFTWRAP) && extra_chunks_in(openfile->current) != old_amount)
 			refresh_needed = TRUE;
@@ -258,6 +260,10 @@ void extract_segment(linestruct *top, size_t top_x, linestruct *bot, size_t bot_
 	if (top != bot)
 		for (linestruct *line = top->next; line != bot->next; line = line->next)
 			had_anchor |= line->has_anchor;
+
+	/* When anchored lines leave the buffer, the list of anchors is outdated. */
+	if (had_anchor)
+		openfile->anchors_listed = FALSE;
 #endif
 
 	if (top == bot) {
@@ -374,6 +380,15 @@ void ingraft_buffer(linestruct *topline)
 	while (botline->next != NULL)
 		botline = botline->next;
 
+#ifndef NANO_TINY
+	/* The grafted lines may carry anchors. */
+	openfile->anchors_listed = FALSE;
+#endif
+#ifdef ENABLE_COLOR
+	/* The grafted text may change the state of the multiline regexes. */
+	discard_checkpoints_from(line);
+#endif
+
 	/* Add the size of the text to be grafted to the buffer size. */
 	openfile->totsize += number_of_characters_in(topline, botline);
 
@@ -151,21 +151,82 @@
 #define THE_DEFAULT  -1
 #define BAD_COLOR  -2
 
-/* Flags for indicating how a multiline regex pair apply to a line. */
-#define NOTHING      (1<<1)
+/* Values for indicating how a multiline regex pair apply to a line.
+ * A value of zero means that this has not been determined yet. */
+#define NOTHING      1
 		/* The start/end regexes don't cover this line at all. */
-#define STARTSHERE   (1<<2)
+#define STARTSHERE   2
 		/* The start regex matches on this line, the end regex on a later one. */
-#define WHOLELINE    (1<<3)
+#define WHOLELINE    3
 		/* The start regex matches on an earlier line, the end regex on a later one. */
-#define ENDSHERE     (1<<4)
+#define ENDSHERE     4
 		/* The start regex matches on an earlier line, the end regex on this one. */
-#define JUSTONTHIS   (1<<5)
+#define JUSTONTHIS   5
 		/* Both the start and end regexes match within this line. */
-#define WOULDBE      (1<<6)
+#define WOULDBE      6
 		/* An unpaired start match is on or before this line. */
+
+/* The number of bits that hold the above value for one multiline regex. */
+#define MULTI_WIDTH  3
+/* How many multiline regexes can have their state stored in a line node. */
+#define MAX_MULTIS  ((short)(sizeof(unsigned long long) * 8 / MULTI_WIDTH))
+
+/* The distance in lines between two resynchronization points for the
+ * multiline coloring, to bound the backward search in draw_row(). */
+#define CHECKPOINT_STRIDE  256
+
+/* How many lines are grouped into one block of the tree that keeps count
+ * of the screen rows that the lines of a buffer take when softwrapped. */
+#define ROWCOUNT_STRIDE  256
+
+/* How many lines are grouped into one block of the index that tallies, for
+ * each pair of brackets, how much the lines change the nesting depth. */
+#define BRACKET_STRIDE  64
+
+/* How many bytes beyond the visible part of a line the single-line regexes
+ * get to see, so that overlong lines are not searched in their entirety. */
+#define COLORING_MARGIN  16384
+
+/* The default number of milliseconds that coloring may take per update. */
+#define COLOR_BUDGET  100
+
+/* The two phases of syntax coloring that the profiler keeps apart. */
+#define PRECALCULATING  0
+#define PAINTING  1
 #endif
 
+/* How many long lines remember where their softwrapped chunks begin. */
+#define CHUNKMAPS  8
+
+/* The distance in bytes between two checkpoints in the column index of a
+ * long line, and the length from which onward a line gets such an index. */
+#define COLUMN_STRIDE  1024
+#define LONG_LINE  (8 * COLUMN_STRIDE)
+
+/* How many long lines can have a column index at the same time. */
+#define COLUMNINDEXES  4
+
+/* How many lines ahead to look for where an old and a new text agree again,
+ * and for how many lines in a row they must then agree. */
+#define PATCH_REACH  200
+#define PATCH_RUN  3
+
+/* Into how many buckets the shortcuts are sorted, by keycode and by function,
+ * so that looking one up does not require walking the whole list. */
+#define SHORTCUT_BUCKETS  251
+
+/* For how many functions or shortcuts space is allocated at once. */
+#define LIST_BATCH  64
+
+/* The number of slots in a latency histogram: one for under a microsecond,
+ * and then four per doubling of the time, up to about an hour. */
+#define LATENCY_BUCKETS  128
+
+/* The three stretches of handling a keystroke that the tracer keeps apart. */
+#define WAITING  0
+#define HANDLING  1
+#define OUTPUTTING  2
+
 /* Basic control codes. */
 #define ESC_CODE  0x1B
 #define DEL_CODE  0x7F
@@ -286,7 +347,7 @@ typedef enum {
 #ifdef ENABLE_COMMENT
 	COMMENT, UNCOMMENT, PREFLIGHT,
 #endif
-	ZAP, CUT, CUT_TO_EOF, COPY, PASTE, INSERT,
+	ZAP, CUT, CUT_TO_EOF, COPY, PASTE, INSERT, PATCH,
 	COUPLE_BEGIN, COUPLE_END, OTHER
 } undo_type;
 
@@ -362,7 +423,51 @@ enum {
 };
 
 /* Structure types. */
+#ifndef NANO_TINY
+typedef struct tracetype {
+	void (*func)(void);
+		/* The function that the traced keystrokes were bound to. */
+	const char *name;
+		/* The tag of that function, or a stand-in for typing. */
+	size_t count;
+		/* How many keystrokes were traced for this function. */
+	size_t buckets[LATENCY_BUCKETS];
+		/* How many of them took how long, on a logarithmic scale. */
+	unsigned long long nanoseconds[3];
+		/* The time spent in waiting, handling, and outputting, in total. */
+	unsigned long long longest;
+		/* The longest time from arrival to display of a keystroke. */
+	size_t rows;
+		/* How many rows of the edit window were drawn for them, in total. */
+	size_t scrolls;
+		/* How many times the edit window was scrolled for them. */
+	size_t bars;
+		/* How many title bars, minibars, and help lines were drawn. */
+	size_t bytes;
+		/* How many bytes were written for them (counted on Linux only). */
+	struct tracetype *next;
+		/* Next traced function. */
+} tracetype;
+#endif
+
 #ifdef ENABLE_COLOR
+typedef struct profiletype {
+	const char *syntaxname;
+		/* The name of the syntax that the rule belongs to. */
+	char *filename;
+		/* The file in which the rule was defined. */
+	size_t lineno;
+		/* The line on which the rule was defined. */
+	char *regex;
+		/* The (starting) regex of the rule, as written. */
+	unsigned long long nanoseconds[2];
+		/* The time spent on the rule while precalculating and painting. */
+	size_t applied[2];
+		/* How often the rule was applied to a line in each phase. */
+	struct profiletype *next;
+		/* Next profiled rule. */
+} profiletype;
+
 typedef struct colortype {
 	short id;
 		/* An ordinal number (if this color combo is for a multiline regex). */
@@ -378,6 +483,8 @@ typedef struct colortype {
 		/* The compiled regular expression for 'start=', or the only one. */
 	regex_t *end;
 		/* The compiled regular expression for 'end=', if any. */
+	profiletype *profile;
+		/* Where the time spent on this rule is tallied, when profiling. */
 	struct colortype *next;
 		/* Next color combination. */
 } colortype;
@@ -385,6 +492,8 @@ typedef struct colortype {
 typedef struct regexlisttype {
 	regex_t *one_rgx;
 		/* A regex to match things that imply a certain syntax. */
+	char *expression;
+		/* The uncompiled form of this regex, when compiling is postponed. */
 	struct regexlisttype *next;
 		/* The next regex. */
 } regexlisttype;
@@ -460,12 +569,14 @@ typedef struct linestruct {
 	struct linestruct *prev;
 		/* Previous node. */
 #ifdef ENABLE_COLOR
-	short *multidata;
-		/* Array of which multi-line regexes apply to this line. */
+	unsigned long long multidata;
+		/* Which multi-line regexes apply to this line, packed in bits. */
 #endif
 #ifndef NANO_TINY
 	bool has_anchor;
 		/* Whether the user has placed an anchor at this line. */
+	int extrarows;
+		/* How many extra rows this line takes when softwrapped; -1 if unknown. */
 #endif
 } linestruct;
 
@@ -477,6 +588,10 @@ typedef struct groupstruct {
 		/* Last line of group. */
 	char **indentations;
 		/* String data used to restore the affected lines; one per line. */
+	unsigned char *affected;
+		/* For a batch: one bit per line, set when that line was changed. */
+	linestruct *lines;
+		/* For a patch: the lines to put in place of the ones in the group. */
 	struct groupstruct *next;
 		/* The next group, if any. */
 } groupstruct;
@@ -499,11 +614,17 @@ typedef struct undostruct {
 	groupstruct *grouping;
 		/* Undo info specific to groups of lines. */
 	linestruct *cutbuffer;
-		/* A copy of the cutbuffer. */
+		/* The cut text, or the pasted text after an undo. */
 	ssize_t tail_lineno;
 		/* Mostly the line number of the current line; sometimes something else. */
 	size_t tail_x;
 		/* The x position corresponding to the above line number. */
+	size_t room;
+		/* For an addition: how many bytes strdata has space for. */
+	size_t weight;
+		/* How many bytes of text this item holds, as last measured. */
+	off_t journaled;
+		/* Where the text of this item sits in the journal; -1 when in memory. */
 	struct undostruct *next;
 		/* A pointer to the undo item of the preceding action. */
 } undostruct;
@@ -569,12 +690,47 @@ typedef struct openfilestruct {
 		/* The undo item at which the file was last saved. */
 	undo_type last_action;
 		/* The type of the last action the user performed. */
+	size_t undosize;
+		/* How many bytes of text the measured undo items hold in memory. */
+	FILE *journal;
+		/* The temporary file where the text of old undo items is kept. */
+	size_t *rowtree;
+		/* A Fenwick tree of how many screen rows each block of lines takes. */
+	size_t rowblocks;
+		/* How many blocks of lines the above tree covers. */
+	size_t rowsvalid;
+		/* How many of those blocks are still correctly counted. */
+	size_t rowlayout;
+		/* The width, tab size and wrapping mode the counts were made for. */
+	linestruct **anchors;
+		/* The lines that carry an anchor, in the order of the buffer. */
+	size_t anchorroom;
+		/* How many lines the above array has room for. */
+	size_t anchorcount;
+		/* How many lines in that array carry an anchor. */
+	bool anchors_listed;
+		/* Whether the above array is still up to date. */
+	int *bracketsums;
+		/* For each block of lines and each bracket pair: the net change in
+		 * nesting depth, and the lowest depth that is reached along the way. */
+	bool *bracketknown;
+		/* For each block of lines, whether the above sums are up to date. */
+	size_t bracketroom;
+		/* How many blocks the above arrays have room for. */
+	size_t brackethigh;
+		/* Beyond this block, none of the sums are up to date. */
 #endif
 	bool modified;
 		/* Whether the file has been modified. */
 #ifdef ENABLE_COLOR
 	syntaxtype *syntax;
 		/* The syntax that applies to this file, if any. */
+	bool *checkpoints;
+		/* For each checkpoint line, which multiline regexes are unpaired there. */
+	size_t checkroom;
+		/* How many checkpoints the above array has room for. */
+	size_t checkvalid;
+		/* How many of those checkpoints are still up to date. */
 #endif
 #ifdef ENABLE_MULTIBUFFER
 	char *errormessage;
@@ -586,6 +742,74 @@ typedef struct openfilestruct {
 #endif
 } openfilestruct;
 
+#ifndef NANO_TINY
+typedef struct versionstruct {
+	linestruct **lines;
+		/* The lines of a text, in order. */
+	size_t *prints;
+		/* The fingerprint of each of those lines. */
+	size_t count;
+		/* The number of lines. */
+} versionstruct;
+
+typedef struct chunkmapstruct {
+	const linestruct *line;
+		/* The line that was mapped. */
+	const char *text;
+		/* The address of the text of that line at the time of mapping. */
+	int width;
+		/* The width of the edit window at the time of mapping. */
+	ssize_t tabsize;
+		/* The tab size at the time of mapping. */
+	bool at_blanks;
+		/* Whether softwrapping happened at blanks. */
+	size_t count;
+		/* The number of chunks that the line consists of. */
+	size_t *leftedges;
+		/* The starting column of each chunk, plus the end of the last one. */
+} chunkmapstruct;
+
+typedef struct columnindexstruct {
+	const linestruct *line;
+		/* The line whose text was indexed. */
+	const char *text;
+		/* The address of the text of that line at the time of indexing. */
+	ssize_t tabsize;
+		/* The tab size at the time of indexing. */
+	size_t count;
+		/* The number of checkpoints, including the one at the start. */
+	size_t room;
+		/* How many checkpoints the arrays below have room for. */
+	size_t *offsets;
+		/* The byte offset of each checkpoint, roughly a stride apart. */
+	size_t *columns;
+		/* The column at which the character at that offset begins. */
+} columnindexstruct;
+#endif
+
+typedef struct rowstruct {
+	const openfilestruct *buffer;
+		/* The buffer that the row was drawn for. */
+	const linestruct *line;
+		/* The line that the row shows (a piece of), or NULL when unknown. */
+	ssize_t lineno;
+		/* The number of that line at the time of drawing. */
+	size_t from_col;
+		/* The first column of the line that the row shows. */
+	size_t fingerprint;
+		/* A hash of the text of the line at the time of drawing. */
+	bool anchored;
+		/* Whether the line had an anchor at the time of drawing. */
+#ifdef ENABLE_COLOR
+	const syntaxtype *syntax;
+		/* The syntax that was used for coloring the row. */
+	unsigned long long multidata;
+		/* The multiline coloring state of the line after drawing. */
+	unsigned long long priordata;
+		/* The multiline coloring state of the preceding line at that time. */
+#endif
+} rowstruct;
+
 #ifdef ENABLE_NANORC
 typedef struct rcoption {
 	const char *name;
@@ -617,6 +841,10 @@ typedef struct keystruct {
 #endif
 	struct keystruct *next;
 		/* Next in the list. */
+	struct keystruct *samekey;
+		/* Next in the list whose keycode falls into the same bucket. */
+	struct keystruct *samefunc;
+		/* Next in the list whose function falls into the same bucket. */
 } keystruct;
 
 typedef struct funcstruct {
@@ -89,6 +89,23 @@ void make_new_buffer(void)
 	openfile->current_undo = NULL;
 	openfile->last_saved = NULL;
 	openfile->last_action = OTHER;
+	openfile->undosize = 0;
+	openfile->journal = NULL;
+
+	openfile->rowtree = NULL;
+	openfile->rowblocks = 0;
+	openfile->rowsvalid = 0;
+	openfile->rowlayout = 0;
+
+	openfile->anchors = NULL;
+	openfile->anchorroom = 0;
+	openfile->anchorcount = 0;
+	openfile->anchors_listed = FALSE;
+
+	openfile->bracketsums = NULL;
+	openfile->bracketknown = NULL;
+	openfile->bracketroom = 0;
+	openfile->brackethigh = 0;
 
 	openfile->statinfo = NULL;
 	openfile->lock_filename = NULL;
@@ -98,6 +115,9 @@ void make_new_buffer(void)
 #endif
 #ifdef ENABLE_COLOR
 	openfile->syntax = NULL;
+	openfile->checkpoints = NULL;
+	openfile->checkroom = 0;
+	openfile->checkvalid = 0;
 #endif
 }
 
@@ -482,6 +502,21 @@ bool open_buffer(const char *filename, bool new_one)
  * then update the title bar to display the buffer's new status. */
 void set_modified(void)
 {
+#ifdef ENABLE_COLOR
+	/* The edit may have changed the state of the multiline regexes. */
+	discard_checkpoints_from(openfile->current);
+#ifndef NANO_TINY
+	if (openfile->mark)
+		discard_checkpoints_from(openfile->mark);
+#endif
+#endif
+#ifndef NANO_TINY
+	/* The edited line may now take a different number of rows, and may
+	 * have changed the nesting of brackets.  Operations that change all
+	 * marked lines recount those themselves. */
+	recount_rows(openfile->current, openfile->current);
+	forget_bracket_sums(openfile->current, openfile->current);
+#endif
 	if (openfile->modified)
 		return;
 
@@ -503,7 +538,7 @@ void prepare_for_display(void)
 
 #ifdef ENABLE_COLOR
 	/* Precalculate the data for any multiline coloring regexes. */
-	if (!openfile->filetop->multidata)
+	if (openfile->filetop->multidata == 0)
 		precalc_multicolorinfo();
 	have_palette = FALSE;
 #endif
@@ -599,10 +634,19 @@ void close_buffer(void)
 #ifndef NANO_TINY
 	free(orphan->statinfo);
 	free(orphan->lock_filename);
-	/* Free the undo stack. */
+	/* Free the undo stack, and drop its journal. */
 	discard_until(NULL);
+	if (orphan->journal != NULL)
+		fclose(orphan->journal);
+	free(orphan->rowtree);
+	free(orphan->anchors);
+	free(orphan->bracketsums);
+	free(orphan->bracketknown);
 #endif
 	free(orphan->errormessage);
+#ifdef ENABLE_COLOR
+	free(orphan->checkpoints);
+#endif
 
 	openfile = orphan->prev;
 	if (openfile == orphan)
@@ -629,17 +673,11 @@ char *encode_data(char *text, size_t length)
 /* The number of bytes by which we expand the line buffer while reading. */
 #define LUMPSIZE  120
 
-/* Read the given open file f into the current buffer.  filename should be
- * set to the name of the file.  undoable means that undo records should be
- * created and that the file does not need to be checked for writability. */
-void read_file(FILE *f, int fd, const char *filename, bool undoable)
+/* Read the given open file f into a new list of lines, and return the top
+ * of that list.  Also return the number of lines that were read, and the
+ * type of line ending that the file uses.  The file gets closed. */
+linestruct *read_lines(FILE *f, size_t *num_lines, format_type *format)
 {
-	ssize_t was_lineno = openfile->current->lineno;
-		/* The line number where we start the insertion. */
-	size_t was_leftedge = 0;
-		/* The leftedge where we start the insertion. */
-	size_t num_lines = 0;
-		/* The number of lines in the file. */
 	size_t len = 0;
 		/* The length of the current line of the file. */
 	size_t bufsize = LUMPSIZE;
@@ -654,18 +692,9 @@ void read_file(FILE *f, int fd, const char *filename, bool undoable)
 		/* The current value we read from the file, either a byte or EOF. */
 	int errornumber;
 		/* The error code, in case an error occurred during reading. */
-	bool writable = TRUE;
-		/* Whether the file is writable (in case we care). */
-#ifndef NANO_TINY
-	format_type format = NIX_FILE;
-		/* The type of line ending the file uses: Unix, DOS, or Mac. */
 
-	if (undoable)
-		add_undo(INSERT, NULL);
-
-	if (ISSET(SOFTWRAP))
-		was_leftedge = leftedge_for(xplustabs(), openfile->current);
-#endif
+	*num_lines = 0;
+	*format = NIX_FILE;
 
 	/* Create an empty buffer. */
 	topline = make_new_node(NULL);
@@ -695,13 +724,13 @@ void read_file(FILE *f, int fd, const char *filename, bool undoable)
 		if (input == '\n') {
 #ifndef NANO_TINY
 			if (len > 0 && buf[len - 1] == '\r' && !ISSET(NO_CONVERT)) {
-				if (num_lines == 0)
-					format = DOS_FILE;
+				if (*num_lines == 0)
+					*format = DOS_FILE;
 				len--;
 			}
-		} else if ((num_lines == 0 || format == MAC_FILE) &&
+		} else if ((*num_lines == 0 || *format == MAC_FILE) &&
 					len > 0 && buf[len - 1] == '\r' && !ISSET(NO_CONVERT)) {
-			format = MAC_FILE;
+			*format = MAC_FILE;
 			len--;
 #endif
 		} else {
@@ -726,7 +755,7 @@ void read_file(FILE *f, int fd, const char *filename, bool undoable)
 		bottomline->data = encode_data(buf, len);
 		bottomline->next = make_new_node(bottomline);
 		bottomline = bottomline->next;
-		num_lines++;
+		(*num_lines)++;
 
 		/* Reset the length in preparation for the next line. */
 		len = 0;
@@ -765,9 +794,6 @@ void read_file(FILE *f, int fd, const char *filename, bool undoable)
 
 	fclose(f);
 
-	if (fd > 0 && !undoable && !ISSET(VIEW_MODE))
-		writable = (access(filename, W_OK) == 0);
-
 	/* If the file ended with a newline, or it was entirely empty, make the
 	 * last line blank.  Otherwise, put the last read data in. */
 	if (len == 0)
@@ -779,15 +805,15 @@ void read_file(FILE *f, int fd, const char *filename, bool undoable)
 		/* If the final character is a CR and file conversion isn't disabled,
 		 * strip this CR and indicate that an extra blank line is needed. */
 		if (buf[len - 1] == '\r' && !ISSET(NO_CONVERT)) {
-			if (num_lines == 0)
-				format = MAC_FILE;
+			if (*num_lines == 0)
+				*format = MAC_FILE;
 			buf[--len] = '\0';
 			mac_line_needs_newline = TRUE;
 		}
 #endif
 		/* Store the data of the final line. */
 		bottomline->data = encode_data(buf, len);
-		num_lines++;
+		(*num_lines)++;
 
 #ifndef NANO_TINY
 		if (mac_line_needs_newline) {
@@ -800,6 +826,40 @@ void read_file(FILE *f, int fd, const char *filename, bool undoable)
 
 	free(buf);
 
+	return topline;
+}
+
+/* Read the given open file f into the current buffer.  filename should be
+ * set to the name of the file.  undoable means that undo records should be
+ * created and that the file does not need to be checked for writability. */
+void read_file(FILE *f, int fd, const char *filename, bool undoable)
+{
+	ssize_t was_lineno = openfile->current->lineno;
+		/* The line number where we start the insertion. */
+	size_t was_leftedge = 0;
+		/* The leftedge where we start the insertion. */
+	size_t num_lines;
+		/* The number of lines in the file. */
+	linestruct *topline;
+		/* The top of the new buffer where we store the read file. */
+	bool writable = TRUE;
+		/* Whether the file is writable (in case we care). */
+	format_type format;
+		/* The type of line ending the file uses: Unix, DOS, or Mac. */
+
+#ifndef NANO_TINY
+	if (undoable)
+		add_undo(INSERT, NULL);
+
+	if (ISSET(SOFTWRAP))
+		was_leftedge = leftedge_for(xplustabs(), openfile->current);
+#endif
+
+	topline = read_lines(f, &num_lines, &format);
+
+	if (fd > 0 && !undoable && !ISSET(VIEW_MODE))
+		writable = (access(filename, W_OK) == 0);
+
 	/* Insert the just read buffer into the current one. */
 	ingraft_buffer(topline);
 
@@ -1056,6 +1116,7 @@ bool execute_command(const char *command)
 			add_undo(CUT, NULL);
 			do_snip(openfile->mark != NULL, openfile->mark == NULL, FALSE);
 			openfile->filetop->has_anchor = FALSE;
+			openfile->anchors_listed = FALSE;
 			update_undo(CUT);
 		}
 
@@ -2004,10 +2065,8 @@ bool write_file(const char *name, FILE *thefile, bool normal,
 
 			/* If the syntax changed, discard and recompute the multidata. */
 			if (strcmp(oldname, newname) != 0) {
-				for (line = openfile->filetop; line != NULL; line = line->next) {
-					free(line->multidata);
-					line->multidata = NULL;
-				}
+				for (line = openfile->filetop; line != NULL; line = line->next)
+					line->multidata = 0;
 
 				precalc_multicolorinfo();
 				have_palette = FALSE;
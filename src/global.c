@@ -22,6 +22,7 @@
 #include "prototypes.h"
 
 #include <ctype.h>
+#include <stdint.h>
 #include <string.h>
 #include <strings.h>
 
@@ -137,6 +138,21 @@ int *bardata = NULL;
 		/* An array of characters that together depict the scrollbar. */
 ssize_t stripe_column = 0;
 		/* The column at which a vertical bar will be drawn. */
+ssize_t framerate = 0;
+		/* How many times per second the edit window may be repainted. */
+char *latencylog = NULL;
+		/* The file where the latencies of keystrokes get written. */
+ssize_t undobudget = 0;
+		/* How many megabytes of text the undo history may keep in memory. */
+#endif
+
+#ifdef ENABLE_COLOR
+ssize_t colorbudget = COLOR_BUDGET;
+		/* How many milliseconds coloring may take per screen update. */
+char *colorprofile = NULL;
+		/* The file where a profile of the syntax coloring gets written. */
+volatile sig_atomic_t profile_requested = FALSE;
+		/* Set to TRUE by the handler whenever a SIGUSR1 occurs. */
 #endif
 
 linestruct *cutbuffer = NULL;
@@ -207,6 +223,12 @@ int currmenu = MMOST;
 		/* The currently active menu, initialized to a dummy value. */
 keystruct *sclist = NULL;
 		/* The start of the shortcuts list. */
+keystruct *keybucket[SHORTCUT_BUCKETS];
+		/* The first shortcut in the list for each bucket of keycodes. */
+keystruct *funcbucket[SHORTCUT_BUCKETS];
+		/* The first shortcut in the list for each bucket of functions. */
+keystruct *indexed_head = NULL;
+		/* The start of the shortcuts list when the buckets were filled. */
 funcstruct *allfuncs = NULL;
 		/* The start of the functions list. */
 funcstruct *tailfunc;
@@ -316,7 +338,18 @@ void do_cancel(void)  {;}
 void add_to_funcs(void (*func)(void), int menus, const char *desc,
 					const char *help, bool blank_after, bool viewok)
 {
-	funcstruct *f = nmalloc(sizeof(funcstruct));
+	static funcstruct *batch;
+	static size_t left = 0;
+	funcstruct *f;
+
+	/* Take the item from a batch instead of allocating each one apart. */
+	if (left == 0) {
+		batch = nmalloc(LIST_BATCH * sizeof(funcstruct));
+		left = LIST_BATCH;
+	}
+
+	f = batch++;
+	left--;
 
 	if (allfuncs == NULL)
 		allfuncs = f;
@@ -385,10 +418,21 @@ void add_to_sclist(int menus, const char *scstring, const int keycode,
 						void (*func)(void), int toggle)
 {
 	static keystruct *tailsc;
+	static keystruct *batch;
+	static size_t left = 0;
 #ifndef NANO_TINY
 	static int counter = 0;
 #endif
-	keystruct *sc = nmalloc(sizeof(keystruct));
+	keystruct *sc;
+
+	/* Take the item from a batch instead of allocating each one apart. */
+	if (left == 0) {
+		batch = nmalloc(LIST_BATCH * sizeof(keystruct));
+		left = LIST_BATCH;
+	}
+
+	sc = batch++;
+	left--;
 
 	/* Start the list, or tack on the next item. */
 	if (sclist == NULL)
@@ -412,11 +456,53 @@ void add_to_sclist(int menus, const char *scstring, const int keycode,
 	tailsc = sc;
 }
 
+/* Sort the shortcuts into buckets by keycode and by function, keeping
+ * within each bucket the order of the list, so that a lookup finds the
+ * same shortcut as a walk through the whole list would. */
+void index_the_shortcuts(void)
+{
+	keystruct *lastkey[SHORTCUT_BUCKETS] = {NULL};
+	keystruct *lastfunc[SHORTCUT_BUCKETS] = {NULL};
+
+	for (size_t index = 0; index < SHORTCUT_BUCKETS; index++) {
+		keybucket[index] = NULL;
+		funcbucket[index] = NULL;
+	}
+
+	for (keystruct *sc = sclist; sc != NULL; sc = sc->next) {
+		size_t bykey = (unsigned int)sc->keycode % SHORTCUT_BUCKETS;
+		size_t byfunc = (uintptr_t)sc->func % SHORTCUT_BUCKETS;
+
+		if (lastkey[bykey] == NULL)
+			keybucket[bykey] = sc;
+		else
+			lastkey[bykey]->samekey = sc;
+
+		if (lastfunc[byfunc] == NULL)
+			funcbucket[byfunc] = sc;
+		else
+			lastfunc[byfunc]->samefunc = sc;
+
+		sc->samekey = NULL;
+		sc->samefunc = NULL;
+		lastkey[bykey] = sc;
+		lastfunc[byfunc] = sc;
+	}
+
+	indexed_head = sclist;
+}
+
 /* Return the first shortcut in the list of shortcuts that
  * matches the given func in the given menu. */
 const keystruct *first_sc_for(int menu, void (*func)(void))
 {
-	for (keystruct *sc = sclist; sc != NULL; sc = sc->next)
+	/* A binding from a nanorc gets added at the start of the list,
+	 * so when the start has changed, the buckets must be refilled. */
+	if (indexed_head != sclist)
+		index_the_shortcuts();
+
+	for (keystruct *sc = funcbucket[(uintptr_t)func % SHORTCUT_BUCKETS];
+							sc != NULL; sc = sc->samefunc)
 		if ((sc->menus & menu) && sc->func == func && sc->keystr[0])
 			return sc;
 
@@ -461,7 +547,11 @@ const keystruct *get_shortcut(int *keycode)
 		return NULL;
 #endif
 
-	for (keystruct *sc = sclist; sc != NULL; sc = sc->next) {
+	if (indexed_head != sclist)
+		index_the_shortcuts();
+
+	for (keystruct *sc = keybucket[(unsigned int)*keycode % SHORTCUT_BUCKETS];
+							sc != NULL; sc = sc->samekey) {
 		if ((sc->menus & currmenu) && *keycode == sc->keycode)
 			return sc;
 	}
@@ -641,6 +731,8 @@ void shortcut_init(void)
 	const char *anchor_gist = N_("Place or remove an anchor at the current line");
 	const char *prevanchor_gist = N_("Jump backward to the nearest anchor");
 	const char *nextanchor_gist = N_("Jump forward to the nearest anchor");
+	const char *latency_gist = N_("Show how quickly keystrokes take effect");
+	const char *undousage_gist = N_("Show how much text the undo history holds");
 #endif
 	const char *case_gist = N_("Toggle the case sensitivity of the search");
 	const char *reverse_gist = N_("Reverse the direction of the search");
@@ -1024,6 +1116,11 @@ void shortcut_init(void)
 		/* TRANSLATORS: This *deletes* a line or marked region. */
 		N_("Zap"), WITHORSANS(zap_gist), BLANKAFTER, NOVIEW);
 
+	add_to_funcs(report_latency, MMAIN,
+		N_("Latency"), WITHORSANS(latency_gist), TOGETHER, VIEW);
+	add_to_funcs(report_undo_usage, MMAIN,
+		N_("Undo usage"), WITHORSANS(undousage_gist), BLANKAFTER, VIEW);
+
 	if (!ISSET(RESTRICTED)) {
 #ifdef ENABLE_SPELLER
 		add_to_funcs(do_spell, MMAIN,
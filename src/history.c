@@ -90,6 +90,18 @@ linestruct *find_in_history(const linestruct *start, const linestruct *end,
 	return NULL;
 }
 
+/* Renumber the items of a history list, from the given item onward.  This is
+ * not done with renumber_from(), as that updates the caches of the buffer. */
+static void renumber_history_from(linestruct *item)
+{
+	ssize_t number = (item->prev == NULL) ? 0 : item->prev->lineno;
+
+	while (item != NULL) {
+		item->lineno = ++number;
+		item = item->next;
+	}
+}
+
 /* Update a history list (the one in which item is the current position)
  * with a fresh string text.  That is: add text, or move it to the end. */
 void update_history(linestruct **item, const char *text, bool avoid_duplicates)
@@ -121,7 +133,7 @@ void update_history(linestruct **item, const char *text, bool avoid_duplicates)
 			*htop = after;
 
 		unlink_node(thesame);
-		renumber_from(after);
+		renumber_history_from(after);
 	}
 
 	/* If the history is full, delete the oldest item (the one at the
@@ -131,7 +143,7 @@ void update_history(linestruct **item, const char *text, bool avoid_duplicates)
 
 		*htop = (*htop)->next;
 		unlink_node(oldest);
-		renumber_from(*htop);
+		renumber_history_from(*htop);
 	}
 
 	/* Store the fresh string in the last item, then create a new item. */
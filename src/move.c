@@ -465,7 +465,7 @@ void do_end(void)
 	if (ISSET(SOFTWRAP)) {
 		bool last_chunk = FALSE;
 		size_t leftedge = leftedge_for(was_column, openfile->current);
-		size_t rightedge = get_softwrap_breakpoint(openfile->current->data,
+		size_t rightedge = get_softwrap_breakpoint(openfile->current,
 												leftedge, &last_chunk);
 		size_t rightedge_x;
 
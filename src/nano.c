@@ -37,6 +37,7 @@
 #ifdef HAVE_TERMIOS_H
 #include <termios.h>
 #endif
+#include <time.h>
 #include <unistd.h>
 #ifdef __linux__
 #include <sys/vt.h>
@@ -72,11 +73,12 @@ linestruct *make_new_node(linestruct *prevnode)
 	newnode->next = NULL;
 	newnode->data = NULL;
 #ifdef ENABLE_COLOR
-	newnode->multidata = NULL;
+	newnode->multidata = 0;
 #endif
 	newnode->lineno = (prevnode) ? prevnode->lineno + 1 : 1;
 #ifndef NANO_TINY
 	newnode->has_anchor = FALSE;
+	newnode->extrarows = -1;
 #endif
 
 	return newnode;
@@ -107,10 +109,15 @@ void delete_node(linestruct *line)
 	if (line == openfile->spillage_line)
 		openfile->spillage_line = NULL;
 #endif
-	free(line->data);
-#ifdef ENABLE_COLOR
-	free(line->multidata);
+#ifndef NANO_TINY
+	/* An anchored line that disappears makes the list of anchors outdated. */
+	if (line->has_anchor)
+		openfile->anchors_listed = FALSE;
+
+	/* What was remembered about the layout of the line is now void. */
+	forget_layout_of(line, line);
 #endif
+	free(line->data);
 	free(line);
 }
 
@@ -150,11 +157,12 @@ linestruct *copy_node(const linestruct *src)
 
 	dst->data = copy_of(src->data);
 #ifdef ENABLE_COLOR
-	dst->multidata = NULL;
+	dst->multidata = 0;
 #endif
 	dst->lineno = src->lineno;
 #ifndef NANO_TINY
 	dst->has_anchor = src->has_anchor;
+	dst->extrarows = -1;
 #endif
 
 	return dst;
@@ -189,6 +197,18 @@ void renumber_from(linestruct *line)
 {
 	ssize_t number = (line->prev == NULL) ? 0 : line->prev->lineno;
 
+#ifndef NANO_TINY
+	/* Lines were added or removed here, so the blocks of the bracket index
+	 * are outdated, and the row counts have shifted.  When there is a row
+	 * tree, it gets redone while renumbering. */
+	if (openfile != NULL) {
+		discard_bracket_sums_from(line);
+
+		if (renumber_and_recount(line))
+			return;
+	}
+#endif
+
 	while (line != NULL) {
 		line->lineno = ++number;
 		line = line->next;
@@ -258,6 +278,14 @@ void finish(void)
 #if defined(ENABLE_NANORC) || defined(ENABLE_HISTORIES)
 	display_rcfile_errors();
 #endif
+#ifdef ENABLE_COLOR
+	if (!write_color_profile())
+		fprintf(stderr, _("Could not write coloring profile: %s\n"), strerror(errno));
+#endif
+#ifndef NANO_TINY
+	if (!write_latency_log())
+		fprintf(stderr, _("Could not write latency log: %s\n"), strerror(errno));
+#endif
 
 	/* Get out. */
 	exit(0);
@@ -436,6 +464,9 @@ void window_init(void)
 		bottomwin = newwin(bottomrows, COLS, LINES - bottomrows, 0);
 	}
 
+	/* The new edit window shows nothing yet. */
+	invalidate_rows();
+
 	/* In case the terminal shrunk, make sure the status line is clear. */
 	wnoutrefresh(bottomwin);
 
@@ -911,6 +942,13 @@ void signal_init(void)
 	deed.sa_handler = continue_nano;
 	sigaction(SIGCONT, &deed, NULL);
 #endif
+#ifdef ENABLE_COLOR
+	/* When profiling the coloring, trap SIGUSR1 to write out the profile. */
+	if (colorprofile != NULL) {
+		deed.sa_handler = handle_sigusr1;
+		sigaction(SIGUSR1, &deed, NULL);
+	}
+#endif
 
 #if !defined(NANO_TINY) && !defined(DEBUG)
 	if (getenv("NANO_NOCATCH") == NULL) {
@@ -1012,6 +1050,15 @@ void block_sigwinch(bool blockit)
 }
 #endif
 
+#ifdef ENABLE_COLOR
+/* Handler for SIGUSR1 (a request for the coloring profile). */
+void handle_sigusr1(int signal)
+{
+	/* Let the input routine know that the profile should be written. */
+	profile_requested = TRUE;
+}
+#endif
+
 #ifndef NANO_TINY
 /* Handler for SIGWINCH (window size change). */
 void handle_sigwinch(int signal)
@@ -1099,15 +1146,18 @@ void toggle_this(int flag)
 		case SOFTWRAP:
 			if (!ISSET(SOFTWRAP))
 				openfile->firstcolumn = 0;
+			invalidate_rows();
 			refresh_needed = TRUE;
 			break;
 		case WHITESPACE_DISPLAY:
 			titlebar(NULL);
+			invalidate_rows();
 			refresh_needed = TRUE;
 			break;
 #ifdef ENABLE_COLOR
 		case NO_SYNTAX:
 			precalc_multicolorinfo();
+			invalidate_rows();
 			refresh_needed = TRUE;
 			break;
 		case TABS_TO_SPACES:
@@ -1265,6 +1315,8 @@ void confirm_margin(void)
 		margin = needed_margin;
 		editwincols = COLS - margin - thebar;
 
+		invalidate_rows();
+
 #ifndef NANO_TINY
 		/* Ensure a proper starting column for the first screen row. */
 		ensure_firstcolumn_is_aligned();
@@ -1398,33 +1450,50 @@ bool okay_for_view(const keystruct *shortcut)
 }
 
 #ifndef NANO_TINY
-/* Read in all waiting input bytes and paste them into the buffer in one go. */
+/* Read in all waiting input bytes and paste them into the buffer in one go.
+ * Runs of plain bytes are taken straight from the keystroke buffer, and each
+ * line is gathered in a scratch area that grows by doubling, so that even a
+ * huge paste gets split into lines in a single linear pass. */
 void suck_up_input_and_paste_it(void)
 {
 	linestruct *was_cutbuffer = cutbuffer;
 	linestruct *line = make_new_node(NULL);
-	size_t index = 0;
+	size_t size = 256, index = 0;
+	char *stretch = nmalloc(size);
 
-	line->data = copy_of("");
 	cutbuffer = line;
 
 	while (bracketed_paste) {
-		int input = get_kbinput(edit, BLIND);
+		int input;
+
+		if (index == size) {
+			size *= 2;
+			stretch = nrealloc(stretch, size);
+		}
+
+		index += take_plain_codes(stretch + index, size - index);
+
+		/* When the scratch area got filled, first make more room. */
+		if (index == size)
+			continue;
+
+		input = get_kbinput(edit, BLIND);
 
 		if (input == '\r' || input == '\n') {
+			line->data = measured_copy(stretch, index);
 			line->next = make_new_node(line);
 			line = line->next;
-			line->data = copy_of("");
 			index = 0;
 		} else if ((0x20 <= input && input <= 0xFF && input != DEL_CODE) ||
-														input == '\t') {
-			line->data = nrealloc(line->data, index + 2);
-			line->data[index++] = (char)input;
-			line->data[index] = '\0';
-		} else if (input != BRACKETED_PASTE_MARKER)
+														input == '\t')
+			stretch[index++] = (char)input;
+		else if (input != BRACKETED_PASTE_MARKER)
 			beep();
 	}
 
+	line->data = measured_copy(stretch, index);
+	free(stretch);
+
 	paste_text();
 
 	free_lines(cutbuffer);
@@ -1436,7 +1505,7 @@ void suck_up_input_and_paste_it(void)
 void inject(char *burst, size_t count)
 {
 	linestruct *thisline = openfile->current;
-	size_t datalen = strlen(thisline->data);
+	size_t datalen = openfile->current_x + strlen(thisline->data + openfile->current_x);
 #ifndef NANO_TINY
 	size_t original_row = 0;
 	size_t old_amount = 0;
@@ -1470,6 +1539,9 @@ void inject(char *burst, size_t count)
 	strncpy(thisline->data + openfile->current_x, burst, count);
 
 #ifndef NANO_TINY
+	/* The line may get measured before set_modified() gets called. */
+	trim_layout_of(thisline, openfile->current_x);
+
 	/* When the mark is to the right of the cursor, compensate its position. */
 	if (thisline == openfile->mark && openfile->current_x < openfile->mark_x)
 		openfile->mark_x += count;
@@ -1525,6 +1597,30 @@ void inject(char *burst, size_t count)
 		update_line(openfile->current, openfile->current_x);
 }
 
+#ifndef NANO_TINY
+static struct timespec last_frame;
+		/* When the edit window was last repainted from the main loop. */
+
+/* Return how many milliseconds remain until the edit window may be
+ * repainted again, given the maximum frame rate (if any). */
+static int time_until_next_frame(void)
+{
+	struct timespec now;
+	long interval, elapsed;
+
+	if (framerate == 0)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	interval = 1000 / framerate;
+	elapsed = (now.tv_sec - last_frame.tv_sec) * 1000 +
+					(now.tv_nsec - last_frame.tv_nsec) / 1000000;
+
+	return (elapsed < interval) ? interval - elapsed : 0;
+}
+#endif
+
 /* Read in a keystroke, and execute its command or insert it into the buffer. */
 void process_a_keystroke(void)
 {
@@ -1563,6 +1659,10 @@ void process_a_keystroke(void)
 	/* Check for a shortcut in the main list. */
 	shortcut = get_shortcut(&input);
 
+#ifndef NANO_TINY
+	trace_dispatch(shortcut);
+#endif
+
 	/* If not a command, discard anything that is not a normal character byte. */
 	if (shortcut == NULL) {
 		if (input < 0x20 || input > 0xFF || meta_key)
@@ -2565,9 +2665,20 @@ int main(int argc, char **argv)
 
 		as_an_at = TRUE;
 
-		if ((refresh_needed && LINES > 1) || (LINES == 1 && lastmessage <= HUSH))
-			edit_refresh();
+#ifndef NANO_TINY
+		/* When more keystrokes are waiting, or arrive before the next frame
+		 * is due, handle those first, and repaint only once afterward. */
+		if (refresh_needed && LINES > 1 && keys_are_waiting(time_until_next_frame()))
+			postpone_refresh();
 		else
+#endif
+		if ((refresh_needed && LINES > 1) || (LINES == 1 && lastmessage <= HUSH)) {
+			edit_refresh();
+#ifndef NANO_TINY
+			if (framerate > 0)
+				clock_gettime(CLOCK_MONOTONIC, &last_frame);
+#endif
+		} else
 			place_the_cursor();
 
 #ifndef NANO_TINY
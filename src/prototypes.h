@@ -96,6 +96,14 @@ extern int thebar;
 #ifndef NANO_TINY
 extern int *bardata;
 extern ssize_t stripe_column;
+extern ssize_t framerate;
+extern char *latencylog;
+extern ssize_t undobudget;
+#endif
+#ifdef ENABLE_COLOR
+extern ssize_t colorbudget;
+extern char *colorprofile;
+extern volatile sig_atomic_t profile_requested;
 #endif
 
 extern linestruct *cutbuffer;
@@ -211,6 +219,7 @@ bool is_zerowidth(const char *ch);
 #endif
 int char_length(const char *pointer);
 size_t mbstrlen(const char *pointer);
+size_t ascii_run(const char *string, size_t maxlen);
 int collect_char(const char *string, char *thechar);
 int advance_over(const char *string, size_t *column);
 size_t step_left(const char *buf, size_t pos);
@@ -237,8 +246,17 @@ bool white_string(const char *string);
 void set_interface_colorpairs(void);
 void prepare_palette(void);
 void find_and_prime_applicable_syntax(void);
+short multistate(const linestruct *line, const colortype *ink);
+void set_multistate(linestruct *line, const colortype *ink, short state);
 void check_the_multis(linestruct *line);
+bool unpaired_at_checkpoint(const colortype *varnish, const linestruct *line);
+void discard_checkpoints_from(const linestruct *line);
+bool colored_by_itself(const linestruct *line, bool at_top);
 void precalc_multicolorinfo(void);
+profiletype *make_profile(const char *syntaxname, const char *filename,
+							size_t lineno, const char *regex);
+void time_rule(const colortype *ink, int phase);
+bool write_color_profile(void);
 #endif
 
 /* Most functions in cut.c. */
@@ -278,6 +296,7 @@ void switch_to_prev_buffer(void);
 void switch_to_next_buffer(void);
 void close_buffer(void);
 #endif
+linestruct *read_lines(FILE *f, size_t *num_lines, format_type *format);
 void read_file(FILE *f, int fd, const char *filename, bool undoable);
 int open_file(const char *filename, bool new_one, FILE **f);
 char *get_next_filename(const char *name, const char *suffix);
@@ -408,6 +427,9 @@ void continue_nano(int signal);
 #if !defined(NANO_TINY) || defined(ENABLE_SPELLER) || defined(ENABLE_COLOR)
 void block_sigwinch(bool blockit);
 #endif
+#ifdef ENABLE_COLOR
+void handle_sigusr1(int signal);
+#endif
 #ifndef NANO_TINY
 void handle_sigwinch(int signal);
 void regenerate_screen(void);
@@ -468,6 +490,10 @@ void goto_line_and_column(ssize_t line, ssize_t column, bool retain_answer,
 void do_gotolinecolumn(void);
 #ifndef NANO_TINY
 void do_find_bracket(void);
+void list_the_anchors(void);
+size_t first_anchor_after(ssize_t lineno);
+void discard_bracket_sums_from(const linestruct *line);
+void forget_bracket_sums(const linestruct *top, const linestruct *bot);
 void put_or_lift_anchor(void);
 void to_prev_anchor(void);
 void to_next_anchor(void);
@@ -489,9 +515,22 @@ void do_undo(void);
 void do_redo(void);
 void do_enter(void);
 #ifndef NANO_TINY
+size_t weight_of(const undostruct *u);
+void weigh_undo_item(undostruct *u);
+bool stow_string(const char *text);
+char *fetch_string(void);
+bool stow_lines(const linestruct *list);
+linestruct *fetch_lines(void);
+bool stow_undo_item(undostruct *u);
+void shorten_journal(off_t size);
+void fetch_undo_item(undostruct *u);
+void keep_undo_within_budget(void);
+void report_undo_usage(void);
 void discard_until(const undostruct *thisitem);
 void add_undo(undo_type action, const char *message);
-void update_multiline_undo(ssize_t lineno, char *indentation);
+groupstruct *add_batch_group(linestruct *top, linestruct *bot, bool per_line);
+void mark_as_affected(groupstruct *group, ssize_t lineno);
+bool was_affected(const groupstruct *group, ssize_t lineno);
 void update_undo(undo_type action);
 #endif /* !NANO_TINY */
 #ifdef ENABLE_WRAPPING
@@ -547,6 +586,12 @@ char *mallocstrcpy(char *dest, const char *src);
 char *copy_of(const char *string);
 char *free_and_assign(char *dest, char *src);
 size_t get_page_start(size_t column);
+#ifndef NANO_TINY
+void forget_column_indexes(const linestruct *top, const linestruct *bot);
+void trim_column_index(const linestruct *line, size_t offset);
+size_t nearest_checkpoint(const char *text, size_t maxlen, size_t column,
+							size_t *column_at);
+#endif
 size_t xplustabs(void);
 size_t actual_x(const char *text, size_t column);
 size_t wideness(const char *text, size_t maxlen);
@@ -569,6 +614,13 @@ linestruct *line_from_number(ssize_t number);
 void record_macro(void);
 void run_macro(void);
 size_t get_key_buffer_len(void);
+#ifndef NANO_TINY
+bool keys_are_waiting(int milliseconds);
+size_t take_plain_codes(char *target, size_t room);
+void trace_dispatch(const keystruct *shortcut);
+void report_latency(void);
+bool write_latency_log(void);
+#endif
 #ifdef ENABLE_NANORC
 void implant(const char *string);
 #endif
@@ -594,6 +646,8 @@ void warn_and_briefly_pause(const char *msg);
 void bottombars(int menu);
 void post_one_key(const char *keystroke, const char *tag, int width);
 void place_the_cursor(void);
+void invalidate_rows(void);
+size_t fingerprint_of(const char *text);
 int update_line(linestruct *line, size_t index);
 #ifndef NANO_TINY
 int update_softwrapped_line(linestruct *line);
@@ -602,9 +656,19 @@ bool line_needs_update(const size_t old_column, const size_t new_column);
 int go_back_chunks(int nrows, linestruct **line, size_t *leftedge);
 int go_forward_chunks(int nrows, linestruct **line, size_t *leftedge);
 bool less_than_a_screenful(size_t was_lineno, size_t was_leftedge);
+#ifndef NANO_TINY
+void recount_rows(linestruct *top, const linestruct *bot);
+bool renumber_and_recount(linestruct *line);
+#endif
 void edit_scroll(bool direction);
 #ifndef NANO_TINY
-size_t get_softwrap_breakpoint(const char *text, size_t leftedge,
+size_t find_breakpoint(const char *text, size_t column, size_t leftedge,
+								bool *end_of_line);
+void forget_layout_of(const linestruct *top, const linestruct *bot);
+void trim_layout_of(const linestruct *line, size_t offset);
+chunkmapstruct *chunk_map_for(const linestruct *line);
+size_t chunk_in_map(const chunkmapstruct *map, size_t column);
+size_t get_softwrap_breakpoint(const linestruct *line, size_t leftedge,
 								bool *end_of_line);
 size_t get_chunk_and_edge(size_t column, linestruct *line, size_t *leftedge);
 size_t chunk_for(size_t column, linestruct *line);
@@ -615,6 +679,9 @@ void ensure_firstcolumn_is_aligned(void);
 size_t actual_last_column(size_t leftedge, size_t column);
 void edit_redraw(linestruct *old_current, update_type manner);
 void edit_refresh(void);
+#ifndef NANO_TINY
+void postpone_refresh(void);
+#endif
 void adjust_viewport(update_type manner);
 void full_refresh(void);
 void draw_all_subwindows(void);
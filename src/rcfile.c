@@ -38,6 +38,14 @@
 #define HOME_RC_NAME  RCFILE_NAME
 #endif
 
+#ifndef SYNTAX_CACHE
+#define SYNTAX_CACHE  "syntax_cache"
+#endif
+
+#if defined(__APPLE__) && !defined(st_mtim)
+#define st_mtim  st_mtimespec
+#endif
+
 static const rcoption rcopts[] = {
 	{"boldtext", BOLD_TEXT},
 #ifdef ENABLE_JUSTIFY
@@ -103,9 +111,11 @@ static const rcoption rcopts[] = {
 	{"bookstyle", BOOKSTYLE},
 	{"cutfromcursor", CUT_FROM_CURSOR},
 	{"emptyline", EMPTY_LINE},
+	{"framerate", 0},
 	{"guidestripe", 0},
 	{"indicator", INDICATOR},
 	{"jumpyscrolling", JUMPY_SCROLLING},
+	{"latencylog", 0},
 	{"locking", LOCKING},
 	{"matchbrackets", 0},
 	{"minibar", MINIBAR},
@@ -117,6 +127,7 @@ static const rcoption rcopts[] = {
 	{"tabsize", 0},
 	{"tabstospaces", TABS_TO_SPACES},
 	{"trimblanks", TRIM_BLANKS},
+	{"undobudget", 0},
 	{"unix", MAKE_IT_UNIX},
 	{"whitespace", 0},
 	{"wordbounds", WORD_BOUNDS},
@@ -125,6 +136,8 @@ static const rcoption rcopts[] = {
 	{"zero", ZERO},
 #endif
 #ifdef ENABLE_COLOR
+	{"colorbudget", 0},
+	{"colorprofile", 0},
 	{"titlecolor", 0},
 	{"numbercolor", 0},
 	{"stripecolor", 0},
@@ -155,6 +168,17 @@ static bool seen_color_command = FALSE;
 		/* Whether a syntax definition contains any color commands. */
 static colortype *lastcolor = NULL;
 		/* The end of the color list for the current syntax. */
+static bool postpone_compiling = FALSE;
+		/* Whether file-matching regexes get compiled only when first needed. */
+static bool recording_intros = FALSE;
+		/* Whether to copy the file-matching commands into the new cache. */
+static linestruct *oldcache = NULL;
+		/* The contents of the syntax cache as found on disk. */
+static linestruct *newcache = NULL;
+static linestruct *newcache_tail = NULL;
+		/* Beginning and end of what the syntax cache should contain. */
+static bool cache_outdated = FALSE;
+		/* Whether the syntax cache on disk needs to be rewritten. */
 #endif
 
 #define NUMBER_OF_MENUS  17  /* Remove the deprecated 'extcmd' in 2022. */
@@ -331,6 +355,10 @@ keystruct *strtosc(const char *input)
 		s->func = to_prev_anchor;
 	else if (!strcmp(input, "nextanchor"))
 		s->func = to_next_anchor;
+	else if (!strcmp(input, "latency"))
+		s->func = report_latency;
+	else if (!strcmp(input, "undousage"))
+		s->func = report_undo_usage;
 	else if (!strcmp(input, "undo"))
 		s->func = do_undo;
 	else if (!strcmp(input, "redo"))
@@ -900,6 +928,256 @@ bool is_good_file(char *file)
 }
 
 #ifdef ENABLE_COLOR
+/* Return the path of the syntax cache, or NULL when there is no home for it.
+ * When make_room is TRUE, create the containing directory if needed. */
+char *syntax_cache_path(bool make_room)
+{
+	const char *xdgcachedir = getenv("XDG_CACHE_HOME");
+	char *cachedir, *cachepath;
+
+	if (xdgcachedir != NULL && *xdgcachedir != '\0')
+		cachedir = concatenate(xdgcachedir, "/nano");
+	else if (homedir != NULL)
+		cachedir = concatenate(homedir, "/.cache/nano");
+	else
+		return NULL;
+
+	if (make_room) {
+		if (xdgcachedir == NULL || *xdgcachedir == '\0') {
+			char *parent = concatenate(homedir, "/.cache");
+
+			mkdir(parent, S_IRWXU);
+			free(parent);
+		}
+		mkdir(cachedir, S_IRWXU);
+	}
+
+	cachepath = concatenate(cachedir, "/" SYNTAX_CACHE);
+	free(cachedir);
+
+	return cachepath;
+}
+
+/* Free the given linked list of cache lines. */
+void discard_cache_lines(linestruct *line)
+{
+	while (line != NULL) {
+		linestruct *next = line->next;
+
+		free(line->data);
+		free(line);
+		line = next;
+	}
+}
+
+/* Append the given (allocated) string to the new syntax cache. */
+void add_to_cache(char *text)
+{
+	linestruct *entry = make_new_node(newcache_tail);
+
+	entry->data = text;
+
+	if (newcache == NULL)
+		newcache = entry;
+	else
+		newcache_tail->next = entry;
+	newcache_tail = entry;
+}
+
+/* Remove from the new syntax cache everything after the given line. */
+void drop_from_cache(linestruct *keeper)
+{
+	discard_cache_lines(keeper ? keeper->next : newcache);
+
+	if (keeper == NULL)
+		newcache = NULL;
+	else
+		keeper->next = NULL;
+	newcache_tail = keeper;
+
+	cache_outdated = TRUE;
+}
+
+/* Compose the header line that identifies the given file in the cache. */
+char *cache_label(const char *file, const struct stat *fileinfo)
+{
+	char *label = nmalloc(strlen(file) + 60);
+
+	/* Include the nanoseconds, so that two edits within one second differ. */
+	sprintf(label, "@ %lld.%09ld %lld %s", (long long)fileinfo->st_mtim.tv_sec,
+				(long)fileinfo->st_mtim.tv_nsec, (long long)fileinfo->st_size, file);
+	return label;
+}
+
+/* Start a record for the given file in the new syntax cache, and return TRUE
+ * when this succeeded and the prologue of the file should be recorded. */
+bool record_the_file(const char *file)
+{
+	struct stat fileinfo;
+
+	cache_outdated = TRUE;
+
+	if (ISSET(RESTRICTED) || stat(file, &fileinfo) == -1)
+		return FALSE;
+
+	add_to_cache(cache_label(file, &fileinfo));
+
+	return TRUE;
+}
+
+/* If the syntax cache holds an up-to-date record for the given file, then
+ * create the syntaxes from the file-matching commands in this record, with
+ * their regexes to be compiled only when needed, and return TRUE. */
+bool reuse_cached_intros(char *file)
+{
+	char *was_nanorc = nanorc;
+	size_t was_lineno = lineno;
+	linestruct *record = oldcache;
+	struct stat fileinfo;
+	char *label;
+
+	if (oldcache == NULL || stat(file, &fileinfo) == -1)
+		return FALSE;
+
+	label = cache_label(file, &fileinfo);
+
+	while (record != NULL && strcmp(record->data, label) != 0)
+		record = record->next;
+
+	free(label);
+
+	if (record == NULL)
+		return FALSE;
+
+	add_to_cache(copy_of(record->data));
+
+	nanorc = file;
+	postpone_compiling = TRUE;
+
+	for (record = record->next; record != NULL && *record->data != '@';
+											record = record->next) {
+		char *keyword, *ptr, *text = copy_of(record->data);
+
+		add_to_cache(copy_of(record->data));
+
+		lineno = strtoul(text, &keyword, 10);
+		while (isblank((unsigned char)*keyword))
+			keyword++;
+		ptr = parse_next_word(keyword);
+
+		if (strcmp(keyword, "syntax") == 0) {
+			check_for_nonempty_syntax();
+			begin_new_syntax(ptr);
+			/* The file was free of mistakes, so each syntax had colors. */
+			seen_color_command = TRUE;
+		} else if (strcmp(keyword, "header") == 0 && opensyntax)
+			grab_and_store("header", ptr, &live_syntax->headers);
+#ifdef HAVE_LIBMAGIC
+		else if (strcmp(keyword, "magic") == 0 && opensyntax)
+			grab_and_store("magic", ptr, &live_syntax->magics);
+#endif
+		free(text);
+	}
+
+	postpone_compiling = FALSE;
+	opensyntax = FALSE;
+
+	nanorc = was_nanorc;
+	lineno = was_lineno;
+
+	return TRUE;
+}
+
+/* Read the syntax cache into memory, if it exists and has the right version. */
+void load_syntax_cache(void)
+{
+	char *cachepath = syntax_cache_path(FALSE);
+	linestruct *tail = NULL;
+	FILE *cachefile;
+	char *line = NULL;
+	size_t buf_len = 0;
+	ssize_t read;
+
+	if (cachepath == NULL || ISSET(RESTRICTED)) {
+		free(cachepath);
+		return;
+	}
+
+	cachefile = fopen(cachepath, "rb");
+	free(cachepath);
+
+	if (cachefile == NULL)
+		return;
+
+	/* The first line must name the version of nano that wrote the cache. */
+	if (getline(&line, &buf_len, cachefile) > 0 &&
+				strcmp(line, "nano " VERSION " syntax cache\n") == 0) {
+		while ((read = getline(&line, &buf_len, cachefile)) > 0) {
+			linestruct *entry = make_new_node(tail);
+
+			if (line[read - 1] == '\n')
+				line[--read] = '\0';
+
+			entry->data = copy_of(line);
+
+			if (oldcache == NULL)
+				oldcache = entry;
+			else
+				tail->next = entry;
+			tail = entry;
+		}
+	}
+
+	fclose(cachefile);
+	free(line);
+}
+
+/* Write the file-matching commands of all included syntax files to disk,
+ * if something changed since the cache was read.  Failure is not fatal.
+ * The cache is first written to a temporary file that then replaces it,
+ * so that a nano that starts at the same time never sees half a cache. */
+void save_syntax_cache(void)
+{
+	linestruct *old = oldcache, *new = newcache;
+	char *cachepath, *temppath;
+	FILE *cachefile;
+	int descriptor;
+
+	/* When all cached records were used and nothing new was parsed,
+	 * the cache is still accurate. */
+	while (old != NULL && new != NULL && strcmp(old->data, new->data) == 0) {
+		old = old->next;
+		new = new->next;
+	}
+
+	if ((old != NULL || new != NULL || cache_outdated) && !ISSET(RESTRICTED) &&
+					(cachepath = syntax_cache_path(TRUE)) != NULL) {
+		temppath = concatenate(cachepath, ".XXXXXX");
+		descriptor = mkstemp(temppath);
+		cachefile = (descriptor < 0) ? NULL : fdopen(descriptor, "wb");
+
+		if (cachefile != NULL) {
+			bool failed = (fputs("nano " VERSION " syntax cache\n", cachefile) < 0);
+
+			for (new = newcache; new != NULL && !failed; new = new->next)
+				failed = (fprintf(cachefile, "%s\n", new->data) < 0);
+
+			if (fclose(cachefile) != 0 || failed || rename(temppath, cachepath) != 0)
+				unlink(temppath);
+		} else if (descriptor >= 0) {
+			close(descriptor);
+			unlink(temppath);
+		}
+
+		free(temppath);
+		free(cachepath);
+	}
+
+	discard_cache_lines(oldcache);
+	discard_cache_lines(newcache);
+	oldcache = newcache = newcache_tail = NULL;
+}
+
 /* Partially parse the syntaxes in the given file, or (when syntax
  * is not NULL) fully parse one specific syntax from the file . */
 void parse_one_include(char *file, syntaxtype *syntax)
@@ -913,6 +1191,10 @@ void parse_one_include(char *file, syntaxtype *syntax)
 	if (!is_good_file(file))
 		return;
 
+	/* When the file has not changed, take its prologue from the cache. */
+	if (syntax == NULL && reuse_cached_intros(file))
+		return;
+
 	rcstream = fopen(file, "rb");
 
 	if (rcstream == NULL) {
@@ -927,7 +1209,18 @@ void parse_one_include(char *file, syntaxtype *syntax)
 
 	/* If this is the first pass, parse only the prologue. */
 	if (syntax == NULL) {
+		linestruct *was_tail = newcache_tail;
+		linestruct *was_error = errors_tail;
+
+		recording_intros = record_the_file(file);
 		parse_rcfile(rcstream, TRUE, TRUE);
+		recording_intros = FALSE;
+
+		/* Only a file without mistakes is kept in the cache, so that
+		 * any mistakes get reported again on the next startup. */
+		if (errors_tail != was_error)
+			drop_from_cache(was_tail);
+
 		nanorc = was_nanorc;
 		lineno = was_lineno;
 		return;
@@ -1135,7 +1428,7 @@ bool parse_combination(char *combostr, short *fg, short *bg, int *attributes)
  * add a rule to the current syntax. */
 void parse_rule(char *ptr, int rex_flags)
 {
-	char *names, *regexstring;
+	char *names, *regexstring, *startstring;
 	short fg, bg;
 	int attributes;
 
@@ -1175,6 +1468,8 @@ void parse_rule(char *ptr, int rex_flags)
 		if (ptr == NULL || !compile(regexstring, rex_flags, &start_rgx))
 			return;
 
+		startstring = regexstring;
+
 		if (expectend) {
 			if (strncmp(ptr, "end=", 4) != 0) {
 				jot_error(N_("\"start=\" requires a corresponding \"end=\""));
@@ -1204,6 +1499,10 @@ void parse_rule(char *ptr, int rex_flags)
 		newcolor->bg = bg;
 		newcolor->attributes = attributes;
 
+		/* When profiling, give the rule a place to tally its time. */
+		newcolor->profile = (colorprofile == NULL) ? NULL :
+					make_profile(live_syntax->name, nanorc, lineno, startstring);
+
 		if (lastcolor == NULL)
 			live_syntax->color = newcolor;
 		else
@@ -1272,12 +1571,14 @@ void grab_and_store(const char *kind, char *ptr, regexlisttype **storage)
 			return;
 
 		/* If the regex string is malformed, skip it. */
-		if (!compile(regexstring, NANO_REG_EXTENDED | REG_NOSUB, &packed_rgx))
+		if (!postpone_compiling &&
+					!compile(regexstring, NANO_REG_EXTENDED | REG_NOSUB, &packed_rgx))
 			continue;
 
 		/* Copy the regex into a struct, and hook this in at the end. */
 		newthing = nmalloc(sizeof(regexlisttype));
 		newthing->one_rgx = packed_rgx;
+		newthing->expression = postpone_compiling ? copy_of(regexstring) : NULL;
 		newthing->next = NULL;
 
 		if (lastthing == NULL)
@@ -1405,6 +1706,16 @@ void parse_rcfile(FILE *rcstream, bool just_syntax, bool intros_only)
 		ptr = parse_next_word(ptr);
 
 #ifdef ENABLE_COLOR
+		/* Copy the file-matching commands of an included file to the cache. */
+		if (recording_intros && (strcmp(keyword, "syntax") == 0 ||
+								strcmp(keyword, "header") == 0 ||
+								strcmp(keyword, "magic") == 0)) {
+			char *entry = nmalloc(strlen(keyword) + strlen(ptr) + 24);
+
+			sprintf(entry, "%zu %s %s", lineno, keyword, ptr);
+			add_to_cache(entry);
+		}
+
 		/* Handle extending first... */
 		if (!just_syntax && strcmp(keyword, "extendsyntax") == 0) {
 			augmentstruct *newitem, *extra;
@@ -1648,16 +1959,38 @@ void parse_rcfile(FILE *rcstream, bool just_syntax, bool intros_only)
 			alt_speller = mallocstrcpy(alt_speller, argument);
 		else
 #endif
+#ifdef ENABLE_COLOR
+		if (strcmp(option, "colorbudget") == 0) {
+			if (!parse_num(argument, &colorbudget) || colorbudget < 0) {
+				jot_error(N_("Color budget \"%s\" is invalid"), argument);
+				colorbudget = COLOR_BUDGET;
+			}
+		} else if (strcmp(option, "colorprofile") == 0)
+			colorprofile = mallocstrcpy(colorprofile, argument);
+		else
+#endif
 #ifndef NANO_TINY
 		if (strcmp(option, "backupdir") == 0)
 			backup_dir = mallocstrcpy(backup_dir, argument);
 		else if (strcmp(option, "wordchars") == 0)
 			word_chars = mallocstrcpy(word_chars, argument);
-		else if (strcmp(option, "guidestripe") == 0) {
+		else if (strcmp(option, "latencylog") == 0)
+			latencylog = mallocstrcpy(latencylog, argument);
+		else if (strcmp(option, "undobudget") == 0) {
+			if (!parse_num(argument, &undobudget) || undobudget < 0) {
+				jot_error(N_("Undo budget \"%s\" is invalid"), argument);
+				undobudget = 0;
+			}
+		} else if (strcmp(option, "guidestripe") == 0) {
 			if (!parse_num(argument, &stripe_column) || stripe_column <= 0) {
 				jot_error(N_("Guide column \"%s\" is invalid"), argument);
 				stripe_column = 0;
 			}
+		} else if (strcmp(option, "framerate") == 0) {
+			if (!parse_num(argument, &framerate) || framerate < 0) {
+				jot_error(N_("Frame rate \"%s\" is invalid"), argument);
+				framerate = 0;
+			}
 		} else if (strcmp(option, "tabsize") == 0) {
 			if (!parse_num(argument, &tabsize) || tabsize <= 0) {
 				jot_error(N_("Requested tab size \"%s\" is invalid"), argument);
@@ -1707,6 +2040,11 @@ bool have_nanorc(const char *path, const char *name)
  * and otherwise the system-wide rcfile followed by the user's rcfile. */
 void do_rcfiles(void)
 {
+#ifdef ENABLE_COLOR
+	get_homedir();
+	load_syntax_cache();
+#endif
+
 	if (custom_nanorc) {
 		nanorc = get_full_path(custom_nanorc);
 		if (access(nanorc, F_OK) != 0)
@@ -1734,6 +2072,10 @@ void do_rcfiles(void)
 
 	check_vitals_mapped();
 
+#ifdef ENABLE_COLOR
+	save_syntax_cache();
+#endif
+
 	free(nanorc);
 	nanorc = NULL;
 }
@@ -849,10 +849,130 @@ void do_gotolinecolumn(void)
 }
 
 #ifndef NANO_TINY
+/* Mark the bracket sums of the block that contains the given line, and of
+ * the block of the line before it, and of all later blocks, as outdated. */
+void discard_bracket_sums_from(const linestruct *line)
+{
+	size_t keep = (line->prev == NULL) ? 0 : (line->prev->lineno - 1) / BRACKET_STRIDE;
+
+	while (openfile->brackethigh > keep)
+		openfile->bracketknown[--openfile->brackethigh] = FALSE;
+}
+
+/* Mark the bracket sums of the blocks that contain the lines from top to bot
+ * as outdated, for when those lines were edited but none were added or removed. */
+void forget_bracket_sums(const linestruct *top, const linestruct *bot)
+{
+	size_t block = (top->lineno - 1) / BRACKET_STRIDE;
+	size_t last = (bot->lineno - 1) / BRACKET_STRIDE;
+
+	while (block <= last && block < openfile->brackethigh)
+		openfile->bracketknown[block++] = FALSE;
+}
+
+/* Tally, for each bracket pair in matchbrackets, how much the block of lines
+ * that starts at the given line changes the nesting depth, and how low the
+ * depth dips within the block. */
+void sum_up_bracket_block(const linestruct *line, size_t block)
+{
+	size_t pairs = mbstrlen(matchbrackets) / 2;
+	const char *pointer;
+	int *sums;
+
+	if (block >= openfile->bracketroom) {
+		size_t newroom = block + 1 + openfile->filebot->lineno / BRACKET_STRIDE;
+
+		openfile->bracketsums = nrealloc(openfile->bracketsums,
+									newroom * pairs * 2 * sizeof(int));
+		openfile->bracketknown = nrealloc(openfile->bracketknown, newroom);
+
+		while (openfile->bracketroom < newroom)
+			openfile->bracketknown[openfile->bracketroom++] = FALSE;
+	}
+
+	sums = openfile->bracketsums + block * pairs * 2;
+
+	for (size_t index = 0; index < pairs * 2; index++)
+		sums[index] = 0;
+
+	for (int count = 0; line != NULL && count < BRACKET_STRIDE; count++) {
+		pointer = line->data;
+
+		while ((pointer = mbstrpbrk(pointer, matchbrackets)) != NULL) {
+			const char *spot = mbstrchr(matchbrackets, pointer);
+			size_t index = 0;
+
+			for (const char *bracket = matchbrackets; bracket < spot;
+									bracket += char_length(bracket))
+				index++;
+
+			/* An opening bracket deepens the nesting, a closing one undoes that. */
+			if (index < pairs)
+				sums[index * 2]++;
+			else if (--sums[(index - pairs) * 2] < sums[(index - pairs) * 2 + 1])
+				sums[(index - pairs) * 2 + 1] = sums[(index - pairs) * 2];
+
+			pointer += char_length(pointer);
+		}
+
+		line = line->next;
+	}
+
+	openfile->bracketknown[block] = TRUE;
+
+	if (openfile->brackethigh <= block)
+		openfile->brackethigh = block + 1;
+}
+
+/* When the given line starts a block of lines (or ends one, when going
+ * backward), step over each whole block in which the brackets of the given
+ * pair cannot bring the balance down to zero, and adjust the balance for
+ * the brackets that were skipped.  Return the first line that has to be
+ * searched, or NULL when the search ran off the edge of the buffer. */
+linestruct *leap_over_balanced_blocks(linestruct *line, bool reverse,
+										size_t pair, size_t *balance)
+{
+	size_t pairs = mbstrlen(matchbrackets) / 2;
+
+	while (line != NULL && line->lineno % BRACKET_STRIDE == (reverse ? 0 : 1)) {
+		size_t block = (line->lineno - 1) / BRACKET_STRIDE;
+		linestruct *first = line;
+		int net, lowest;
+
+		if (reverse)
+			for (int count = 1; count < BRACKET_STRIDE; count++)
+				first = first->prev;
+
+		if (block >= openfile->bracketroom || !openfile->bracketknown[block])
+			sum_up_bracket_block(first, block);
+
+		net = openfile->bracketsums[(block * pairs + pair) * 2];
+		lowest = openfile->bracketsums[(block * pairs + pair) * 2 + 1];
+
+		/* When going forward, the depth must dip below the balance in order
+		 * to hit zero; when going backward, the rise at the end must do so. */
+		if ((ssize_t)*balance + (reverse ? lowest - net : lowest) <= 0)
+			return line;
+
+		*balance = (ssize_t)*balance + (reverse ? -net : net);
+
+		if (reverse)
+			line = first->prev;
+		else
+			for (int count = 0; line != NULL && count < BRACKET_STRIDE; count++)
+				line = line->next;
+	}
+
+	return line;
+}
+
 /* Search, starting from the current position, for any of the two characters
  * in bracket_pair.  If reverse is TRUE, search backwards, otherwise forwards.
+ * Whole blocks of lines in which the given pair is balanced relative to the
+ * given balance get skipped, with the balance adjusted accordingly.
  * Return TRUE when one of the brackets was found, and FALSE otherwise. */
-bool find_a_bracket(bool reverse, const char *bracket_pair)
+bool find_a_bracket(bool reverse, const char *bracket_pair,
+						size_t pair, size_t *balance)
 {
 	linestruct *line = openfile->current;
 	const char *pointer, *found;
@@ -860,7 +980,7 @@ bool find_a_bracket(bool reverse, const char *bracket_pair)
 	if (reverse) {
 		/* First step away from the current bracket. */
 		if (openfile->current_x == 0) {
-			line = line->prev;
+			line = leap_over_balanced_blocks(line->prev, TRUE, pair, balance);
 			if (line == NULL)
 				return FALSE;
 			pointer = line->data + strlen(line->data);
@@ -869,7 +989,7 @@ bool find_a_bracket(bool reverse, const char *bracket_pair)
 
 		/* Now seek for any of the two brackets we are interested in. */
 		while (!(found = mbrevstrpbrk(line->data, bracket_pair, pointer))) {
-			line = line->prev;
+			line = leap_over_balanced_blocks(line->prev, TRUE, pair, balance);
 			if (line == NULL)
 				return FALSE;
 			pointer = line->data + strlen(line->data);
@@ -878,7 +998,7 @@ bool find_a_bracket(bool reverse, const char *bracket_pair)
 		pointer = line->data + step_right(line->data, openfile->current_x);
 
 		while (!(found = mbstrpbrk(pointer, bracket_pair))) {
-			line = line->next;
+			line = leap_over_balanced_blocks(line->next, FALSE, pair, balance);
 			if (line == NULL)
 				return FALSE;
 			pointer = line->data;
@@ -913,6 +1033,8 @@ void do_find_bracket(void)
 		/* The index in matchbrackets where the closing brackets start. */
 	size_t charcount = mbstrlen(matchbrackets) / 2;
 		/* Half the number of characters in matchbrackets. */
+	size_t pair = 0;
+		/* The number of the pair that the bracket under the cursor belongs to. */
 	size_t balance = 1;
 		/* The initial bracket count. */
 	bool reverse;
@@ -933,6 +1055,10 @@ void do_find_bracket(void)
 	 * opening bracket; otherwise, forward for a matching closing bracket. */
 	reverse = (ch >= (matchbrackets + halfway));
 
+	for (const char *bracket = matchbrackets; bracket < ch; bracket += char_length(bracket))
+		pair++;
+	pair %= charcount;
+
 	/* Step half the number of total characters either backwards or forwards
 	 * through matchbrackets to find the wanted complementary bracket. */
 	wanted_ch = ch;
@@ -952,7 +1078,7 @@ void do_find_bracket(void)
 	strncpy(bracket_pair + ch_len, wanted_ch, wanted_ch_len);
 	bracket_pair[ch_len + wanted_ch_len] = '\0';
 
-	while (find_a_bracket(reverse, bracket_pair)) {
+	while (find_a_bracket(reverse, bracket_pair, pair, &balance)) {
 		/* Increment/decrement balance for an identical/other bracket. */
 		balance += (strncmp(openfile->current->data + openfile->current_x,
 							ch, ch_len) == 0) ? 1 : -1;
@@ -971,11 +1097,71 @@ void do_find_bracket(void)
 	openfile->current_x = was_current_x;
 }
 
+/* Gather the anchored lines of the current buffer into an ordered list. */
+void list_the_anchors(void)
+{
+	openfile->anchorcount = 0;
+
+	for (linestruct *line = openfile->filetop; line != NULL; line = line->next) {
+		if (!line->has_anchor)
+			continue;
+
+		if (openfile->anchorcount == openfile->anchorroom) {
+			openfile->anchorroom = (openfile->anchorroom == 0) ? 8 : 2 * openfile->anchorroom;
+			openfile->anchors = nrealloc(openfile->anchors,
+									openfile->anchorroom * sizeof(linestruct *));
+		}
+
+		openfile->anchors[openfile->anchorcount++] = line;
+	}
+
+	openfile->anchors_listed = TRUE;
+}
+
+/* Return the index in the list of anchors of the first anchored line that
+ * comes after the given line number, or the number of anchors if none does. */
+size_t first_anchor_after(ssize_t lineno)
+{
+	size_t low = 0, high = openfile->anchorcount;
+
+	while (low < high) {
+		size_t middle = (low + high) / 2;
+
+		if (openfile->anchors[middle]->lineno <= lineno)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
 /* Place an anchor at the current line when none exists, otherwise remove it. */
 void put_or_lift_anchor(void)
 {
 	openfile->current->has_anchor = !openfile->current->has_anchor;
 
+	/* When the list of anchors is up to date, keep it so. */
+	if (openfile->anchors_listed) {
+		size_t index = first_anchor_after(openfile->current->lineno - 1);
+
+		if (openfile->current->has_anchor) {
+			if (openfile->anchorcount == openfile->anchorroom) {
+				openfile->anchorroom = (openfile->anchorroom == 0) ? 8 : 2 * openfile->anchorroom;
+				openfile->anchors = nrealloc(openfile->anchors,
+									openfile->anchorroom * sizeof(linestruct *));
+			}
+			memmove(openfile->anchors + index + 1, openfile->anchors + index,
+						(openfile->anchorcount - index) * sizeof(linestruct *));
+			openfile->anchors[index] = openfile->current;
+			openfile->anchorcount++;
+		} else {
+			memmove(openfile->anchors + index, openfile->anchors + index + 1,
+						(openfile->anchorcount - index - 1) * sizeof(linestruct *));
+			openfile->anchorcount--;
+		}
+	}
+
 	update_line(openfile->current, openfile->current_x);
 
 	if (openfile->current->has_anchor)
@@ -1004,9 +1190,15 @@ void go_to_and_confirm(linestruct *line)
 void to_prev_anchor(void)
 {
 	linestruct *line = openfile->current;
+	size_t index;
 
-	do { line = (line->prev) ? line->prev : openfile->filebot;
-	} while (!line->has_anchor && line != openfile->current);
+	if (!openfile->anchors_listed)
+		list_the_anchors();
+
+	index = first_anchor_after(openfile->current->lineno - 1);
+
+	if (openfile->anchorcount > 0)
+		line = openfile->anchors[(index > 0) ? index - 1 : openfile->anchorcount - 1];
 
 	go_to_and_confirm(line);
 }
@@ -1015,9 +1207,15 @@ void to_prev_anchor(void)
 void to_next_anchor(void)
 {
 	linestruct *line = openfile->current;
+	size_t index;
+
+	if (!openfile->anchors_listed)
+		list_the_anchors();
+
+	index = first_anchor_after(openfile->current->lineno);
 
-	do { line = (line->next) ? line->next : openfile->filetop;
-	} while (!line->has_anchor && line != openfile->current);
+	if (openfile->anchorcount > 0)
+		line = openfile->anchors[(index < openfile->anchorcount) ? index : 0];
 
 	go_to_and_confirm(line);
 }
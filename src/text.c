@@ -119,6 +119,7 @@ void do_indent(void)
 {
 	char *indentation;
 	linestruct *top, *bot, *line;
+	groupstruct *batch;
 
 	/* Use either all the marked lines or just the current line. */
 	get_range(&top, &bot);
@@ -149,16 +150,24 @@ void do_indent(void)
 
 	add_undo(INDENT, NULL);
 
-	/* Go through each of the lines, adding an indent to the non-empty ones,
-	 * and recording whatever was added in the undo item. */
-	for (line = top; line != bot->next; line = line->next) {
-		char *real_indent = (line->data[0] == '\0') ? "" : indentation;
+	/* The undo item keeps the indentation just once, plus a mark for
+	 * each line that gets it. */
+	openfile->current_undo->strdata = indentation;
+	batch = add_batch_group(top, bot, FALSE);
 
-		indent_a_line(line, real_indent);
-		update_multiline_undo(line->lineno, real_indent);
-	}
+	/* Go through each of the lines, adding an indent to the non-empty ones. */
+	for (line = top; line != bot->next; line = line->next)
+		if (line->data[0] != '\0') {
+			indent_a_line(line, indentation);
+			mark_as_affected(batch, line->lineno);
+		}
+
+	/* The indented lines may now take a different number of rows, and
+	 * a custom tab string may have changed the nesting of brackets. */
+	recount_rows(top, bot);
+	forget_bracket_sums(top, bot);
 
-	free(indentation);
+	openfile->current_undo->newsize = openfile->totsize;
 
 	set_modified();
 	ensure_firstcolumn_is_aligned();
@@ -240,6 +249,10 @@ void unindent_a_line(linestruct *line, size_t indent_len)
 void do_unindent(void)
 {
 	linestruct *top, *bot, *line;
+	const char *shared = NULL;
+	size_t shared_len = 0;
+	bool alike = TRUE;
+	groupstruct *batch;
 
 	/* Use either all the marked lines or just the current line. */
 	get_range(&top, &bot);
@@ -252,20 +265,48 @@ void do_unindent(void)
 	if (top == bot->next)
 		return;
 
+	/* See whether all lines lose the same whitespace, as they usually do. */
+	for (line = top; line != bot->next && alike; line = line->next) {
+		size_t indent_len = length_of_white(line->data);
+
+		if (indent_len == 0)
+			continue;
+		else if (shared == NULL) {
+			shared = line->data;
+			shared_len = indent_len;
+		} else
+			alike = (indent_len == shared_len &&
+							strncmp(line->data, shared, shared_len) == 0);
+	}
+
 	add_undo(UNINDENT, NULL);
 
-	/* Go through each of the lines, removing their leading indent where
-	 * possible, and saving the removed whitespace in the undo item. */
+	/* When the removed whitespace is the same everywhere, the undo item keeps
+	 * it just once, plus a mark for each affected line; otherwise it saves
+	 * the whitespace removed from each line separately. */
+	if (alike)
+		openfile->current_undo->strdata = measured_copy(shared, shared_len);
+	batch = add_batch_group(top, bot, !alike);
+
 	for (line = top; line != bot->next; line = line->next) {
 		size_t indent_len = length_of_white(line->data);
-		char *indentation = measured_copy(line->data, indent_len);
 
-		unindent_a_line(line, indent_len);
-		update_multiline_undo(line->lineno, indentation);
+		if (!alike)
+			batch->indentations[line->lineno - batch->top_line] =
+										measured_copy(line->data, indent_len);
+		else if (indent_len > 0)
+			mark_as_affected(batch, line->lineno);
 
-		free(indentation);
+		unindent_a_line(line, indent_len);
 	}
 
+	/* The unindented lines may now take a different number of rows, and
+	 * a custom tab string may have changed the nesting of brackets. */
+	recount_rows(top, bot);
+	forget_bracket_sums(top, bot);
+
+	openfile->current_undo->newsize = openfile->totsize;
+
 	set_modified();
 	ensure_firstcolumn_is_aligned();
 	refresh_needed = TRUE;
@@ -282,15 +323,25 @@ void handle_indent_action(undostruct *u, bool undoing, bool add_indent)
 	if (!undoing)
 		goto_line_posx(u->head_lineno, u->head_x);
 
-	/* For each line in the group, add or remove the individual indent. */
+#ifdef ENABLE_COLOR
+	discard_checkpoints_from(line);
+#endif
+	discard_bracket_sums_from(line);
+
+	/* For each line in the group, add or remove the individual indent,
+	 * or the shared one when the line was affected. */
 	while (line != NULL && line->lineno <= group->bottom_line) {
-		char *blanks = group->indentations[line->lineno - group->top_line];
+		char *blanks = (group->affected == NULL) ?
+						group->indentations[line->lineno - group->top_line] :
+						was_affected(group, line->lineno) ? u->strdata : "";
 
 		if (undoing ^ add_indent)
 			indent_a_line(line, blanks);
 		else
 			unindent_a_line(line, strlen(blanks));
 
+		recount_rows(line, line);
+
 		line = line->next;
 	}
 
@@ -372,6 +423,7 @@ void do_comment(void)
 	undo_type action = UNCOMMENT;
 	linestruct *top, *bot, *line;
 	bool empty, all_empty = TRUE;
+	groupstruct *batch;
 
 #ifdef ENABLE_COLOR
 	if (openfile->syntax)
@@ -413,11 +465,20 @@ void do_comment(void)
 	 * change when the file name changes; we need to know what it was. */
 	openfile->current_undo->strdata = copy_of(comment_seq);
 
+	batch = add_batch_group(top, bot, FALSE);
+
 	/* Comment/uncomment each of the selected lines when possible, and
-	 * store undo data when a line changed. */
+	 * mark in the undo item which lines changed. */
 	for (line = top; line != bot->next; line = line->next)
 		if (comment_line(action, line, comment_seq))
-			update_multiline_undo(line->lineno, "");
+			mark_as_affected(batch, line->lineno);
+
+	/* The changed lines may now take a different number of rows, and
+	 * may have changed the nesting of brackets. */
+	recount_rows(top, bot);
+	forget_bracket_sums(top, bot);
+
+	openfile->current_undo->newsize = openfile->totsize;
 
 	set_modified();
 	ensure_firstcolumn_is_aligned();
@@ -437,9 +498,17 @@ void handle_comment_action(undostruct *u, bool undoing, bool add_comment)
 	while (group) {
 		linestruct *line = line_from_number(group->top_line);
 
+#ifdef ENABLE_COLOR
+		discard_checkpoints_from(line);
+#endif
+		discard_bracket_sums_from(line);
+
 		while (line != NULL && line->lineno <= group->bottom_line) {
-			comment_line(undoing ^ add_comment ?
+			if (group->affected == NULL || was_affected(group, line->lineno)) {
+				comment_line(undoing ^ add_comment ?
 								COMMENT : UNCOMMENT, line, u->strdata);
+				recount_rows(line, line);
+			}
 			line = line->next;
 		}
 
@@ -464,11 +533,24 @@ void undo_cut(undostruct *u)
 	goto_line_posx(u->head_lineno, (u->xflags & WAS_WHOLE_LINE) ? 0 : u->head_x);
 
 	/* Clear an inherited anchor but not a user-placed one. */
-	if (!(u->xflags & HAD_ANCHOR_AT_START))
+	if (!(u->xflags & HAD_ANCHOR_AT_START)) {
 		openfile->current->has_anchor = FALSE;
+		openfile->anchors_listed = FALSE;
+	}
 
-	if (u->cutbuffer)
-		copy_from_buffer(u->cutbuffer);
+	/* Hand the stored text back to the buffer; a redo will snip it again. */
+	if (u->cutbuffer) {
+		/* Forget what was known about the lines, as a fresh copy would. */
+		for (linestruct *line = u->cutbuffer; line != NULL; line = line->next) {
+#ifdef ENABLE_COLOR
+			line->multidata = 0;
+#endif
+			line->extrarows = -1;
+		}
+
+		ingraft_buffer(u->cutbuffer);
+		u->cutbuffer = NULL;
+	}
 
 	/* If originally the last line was cut too, remove an extra magic line. */
 	if ((u->xflags & INCLUDED_LAST_LINE) && !ISSET(NO_NEWLINES) &&
@@ -494,10 +576,157 @@ void redo_cut(undostruct *u)
 
 	do_snip(TRUE, FALSE, u->type == ZAP);
 
-	free_lines(cutbuffer);
+	/* Keep the snipped text in the undo item, for a later undo to reinsert. */
+	free_lines(u->cutbuffer);
+	u->cutbuffer = cutbuffer;
 	cutbuffer = oldcutbuffer;
 }
 
+/* Return the number of characters in the given list of lines, counting
+ * a newline after each line. */
+size_t characters_in_list(const linestruct *line)
+{
+	size_t count = 0;
+
+	for (; line != NULL; line = line->next)
+		count += mbstrlen(line->data) + 1;
+
+	return count;
+}
+
+/* Unlink the given number of lines that follow the given line (or that start
+ * the buffer, when that line is NULL) and link the given list of lines (which
+ * may be NULL) into their place.  Return the unlinked lines, as a list. */
+linestruct *exchange_lines(linestruct *before, size_t count, linestruct *list)
+{
+	linestruct *first = (before == NULL) ? openfile->filetop : before->next;
+	linestruct *last = NULL, *after = first, *bottom = list;
+	bool edittop_inside = FALSE, current_inside = FALSE;
+
+	for (size_t index = 0; index < count; index++) {
+		last = after;
+		after = after->next;
+		edittop_inside |= (last == openfile->edittop);
+		current_inside |= (last == openfile->current);
+		if (last == openfile->mark)
+			openfile->mark = NULL;
+	}
+
+	while (bottom != NULL && bottom->next != NULL)
+		bottom = bottom->next;
+
+	if (list != NULL) {
+		list->prev = before;
+		bottom->next = after;
+	}
+
+	if (before != NULL)
+		before->next = (list != NULL) ? list : after;
+	else
+		openfile->filetop = (list != NULL) ? list : after;
+
+	if (after != NULL)
+		after->prev = (list != NULL) ? bottom : before;
+	else
+		openfile->filebot = (list != NULL) ? bottom : before;
+
+	/* Make sure the viewport and the cursor do not point at removed lines. */
+	if (edittop_inside)
+		openfile->edittop = (list != NULL) ? list : (after != NULL) ? after : before;
+	if (current_inside) {
+		openfile->current = (list != NULL) ? list : (after != NULL) ? after : before;
+		openfile->current_x = 0;
+	}
+
+#ifdef ENABLE_WRAPPING
+	openfile->spillage_line = NULL;
+#endif
+	/* Both the removed and the added lines may carry anchors. */
+	openfile->anchors_listed = FALSE;
+
+	if (count == 0)
+		return NULL;
+
+	first->prev = NULL;
+	last->next = NULL;
+
+	return first;
+}
+
+/* Replace the given number of lines that follow before (or that start the
+ * buffer) with the given list of come lines, and record the replaced lines
+ * as a new group of the given PATCH item, after the group *last.  The group
+ * covers the lines from top_line onward, in the numbering of the result. */
+void record_patch_group(undostruct *u, groupstruct **last, ssize_t top_line,
+				linestruct *before, size_t gone, linestruct *list, size_t come)
+{
+	groupstruct *group = nmalloc(sizeof(groupstruct));
+
+	group->top_line = top_line;
+	group->bottom_line = top_line + come - 1;
+	group->indentations = NULL;
+	group->affected = NULL;
+	group->next = NULL;
+
+	if (*last == NULL)
+		u->grouping = group;
+	else
+		(*last)->next = group;
+	*last = group;
+
+	openfile->totsize += characters_in_list(list);
+	group->lines = exchange_lines(before, gone, list);
+	openfile->totsize -= characters_in_list(group->lines);
+}
+
+/* Undo or redo a patch: for each group, put the lines that the group holds
+ * in place of the lines that the group spans, and keep the latter. */
+void swap_patched_lines(undostruct *u)
+{
+	linestruct *line = openfile->filetop, *first = NULL;
+	ssize_t lineno = 1, shift = 0;
+
+	for (groupstruct *group = u->grouping; group != NULL; group = group->next) {
+		ssize_t count = group->bottom_line - group->top_line + 1;
+		ssize_t incoming = 0;
+		linestruct *before;
+
+		for (linestruct *item = group->lines; item != NULL; item = item->next)
+			incoming++;
+
+		/* Move forward to the first line of the group (or beyond the end). */
+		while (lineno < group->top_line) {
+			line = line->next;
+			lineno++;
+		}
+
+		before = (line != NULL) ? line->prev : openfile->filebot;
+
+		group->lines = exchange_lines(before, count, group->lines);
+
+		if (first == NULL)
+			first = (before != NULL) ? before : openfile->filetop;
+
+		/* Continue from the first line after the group. */
+		line = (before != NULL) ? before->next : openfile->filetop;
+		for (ssize_t index = 0; index < incoming; index++)
+			line = line->next;
+		lineno = group->top_line + count;
+
+		/* Note where the group sits now, for the reverse operation. */
+		group->top_line += shift;
+		group->bottom_line = group->top_line + incoming - 1;
+		shift += incoming - count;
+	}
+
+	renumber_from(first);
+
+	openfile->current = first;
+	openfile->current_x = 0;
+
+	refresh_needed = TRUE;
+}
+
 /* Undo the last thing(s) we did. */
 void do_undo(void)
 {
@@ -512,6 +741,9 @@ void do_undo(void)
 		return;
 	}
 
+	if (u->journaled >= 0)
+		fetch_undo_item(u);
+
 	if (u->type <= REPLACE)
 		line = line_from_number(u->tail_lineno);
 
@@ -619,6 +851,9 @@ void do_undo(void)
 							openfile->filebot != openfile->current)
 			remove_magicline();
 		break;
+	case PATCH:
+		swap_patched_lines(u);
+		break;
 	case COUPLE_BEGIN:
 		undidmsg = u->strdata;
 		goto_line_posx(u->head_lineno, u->head_x);
@@ -629,8 +864,8 @@ void do_undo(void)
 		/* Remember the row of the cursor for a possible redo. */
 		openfile->current_undo->head_lineno = openfile->current_y;
 		openfile->current_undo = openfile->current_undo->next;
-		do_undo();
-		do_undo();
+		while (openfile->current_undo->type != COUPLE_BEGIN)
+			do_undo();
 		do_undo();
 		return;
 	case INDENT:
@@ -658,13 +893,28 @@ void do_undo(void)
 	if (undidmsg && !pletion_line)
 		statusline(HUSH, _("Undid %s"), undidmsg);
 
+	/* An undo can move text into or out of the item. */
+	weigh_undo_item(u);
+
 	openfile->current_undo = openfile->current_undo->next;
 	openfile->last_action = OTHER;
 	openfile->mark = NULL;
+
+	/* The text of any line may have changed, so measure afresh. */
+	forget_layout_of(NULL, NULL);
 	openfile->placewewant = xplustabs();
 
 	openfile->totsize = u->wassize;
 
+#ifdef ENABLE_COLOR
+	/* Even when "Modified" gets unset, the coloring state may have changed. */
+	discard_checkpoints_from(openfile->current);
+#endif
+	/* The nesting of brackets may have changed too. */
+	forget_bracket_sums(openfile->current, openfile->current);
+	/* And the line may now take a different number of rows. */
+	recount_rows(openfile->current, openfile->current);
+
 	/* When at the point where the buffer was last saved, unset "Modified". */
 	if (openfile->current_undo == openfile->last_saved) {
 		openfile->modified = FALSE;
@@ -690,6 +940,9 @@ void do_redo(void)
 	while (u->next != openfile->current_undo)
 		u = u->next;
 
+	if (u->journaled >= 0)
+		fetch_undo_item(u);
+
 	if (u->type <= REPLACE)
 		line = line_from_number(u->tail_lineno);
 
@@ -781,11 +1034,13 @@ void do_redo(void)
 		free_lines(u->cutbuffer);
 		u->cutbuffer = NULL;
 		break;
+	case PATCH:
+		swap_patched_lines(u);
+		break;
 	case COUPLE_BEGIN:
 		openfile->current_undo = u;
-		do_redo();
-		do_redo();
-		do_redo();
+		while (openfile->current_undo->type != COUPLE_END)
+			do_redo();
 		return;
 	case COUPLE_END:
 		redidmsg = u->strdata;
@@ -818,13 +1073,27 @@ void do_redo(void)
 	if (redidmsg)
 		statusline(HUSH, _("Redid %s"), redidmsg);
 
+	weigh_undo_item(u);
+
 	openfile->current_undo = u;
 	openfile->last_action = OTHER;
 	openfile->mark = NULL;
+
+	/* The text of any line may have changed, so measure afresh. */
+	forget_layout_of(NULL, NULL);
 	openfile->placewewant = xplustabs();
 
 	openfile->totsize = u->newsize;
 
+#ifdef ENABLE_COLOR
+	/* Even when "Modified" gets unset, the coloring state may have changed. */
+	discard_checkpoints_from(openfile->current);
+#endif
+	/* The nesting of brackets may have changed too. */
+	forget_bracket_sums(openfile->current, openfile->current);
+	/* And the line may now take a different number of rows. */
+	recount_rows(openfile->current, openfile->current);
+
 	/* When at the point where the buffer was last saved, unset "Modified". */
 	if (openfile->current_undo == openfile->last_saved) {
 		openfile->modified = FALSE;
@@ -911,14 +1180,286 @@ void do_enter(void)
 }
 
 #ifndef NANO_TINY
+/* Return the number of bytes of text that the given undo item holds. */
+size_t weight_of(const undostruct *u)
+{
+	size_t weight = (u->strdata == NULL) ? 0 : strlen(u->strdata) + 1;
+
+	for (linestruct *line = u->cutbuffer; line != NULL; line = line->next)
+		weight += sizeof(linestruct) + strlen(line->data) + 1;
+
+	for (groupstruct *group = u->grouping; group != NULL; group = group->next) {
+		for (ssize_t index = 0; group->indentations != NULL &&
+							index <= group->bottom_line - group->top_line; index++)
+			weight += sizeof(char *) + strlen(group->indentations[index]) + 1;
+		for (linestruct *line = group->lines; line != NULL; line = line->next)
+			weight += sizeof(linestruct) + strlen(line->data) + 1;
+	}
+
+	return weight;
+}
+
+/* Measure anew the text held by the given undo item, and adjust the total. */
+void weigh_undo_item(undostruct *u)
+{
+	openfile->undosize -= u->weight;
+	u->weight = weight_of(u);
+	openfile->undosize += u->weight;
+}
+
+/* Write the given string (possibly NULL) to the journal, preceded by its size. */
+bool stow_string(const char *text)
+{
+	size_t size = (text == NULL) ? 0 : strlen(text) + 1;
+
+	return (fwrite(&size, sizeof(size_t), 1, openfile->journal) == 1 &&
+				(size == 0 || fwrite(text, 1, size, openfile->journal) == size));
+}
+
+/* Read a string (possibly NULL) back from the journal. */
+char *fetch_string(void)
+{
+	size_t size;
+	char *text;
+
+	if (fread(&size, sizeof(size_t), 1, openfile->journal) != 1)
+		die(_("Could not read back the undo history: %s\n"), strerror(errno));
+
+	if (size == 0)
+		return NULL;
+
+	text = nmalloc(size);
+
+	if (fread(text, 1, size, openfile->journal) != size)
+		die(_("Could not read back the undo history: %s\n"), strerror(errno));
+
+	return text;
+}
+
+/* Write the given list of lines (possibly NULL) to the journal, preceded by
+ * their number.  Return FALSE on failure. */
+bool stow_lines(const linestruct *list)
+{
+	size_t count = 0;
+
+	for (const linestruct *line = list; line != NULL; line = line->next)
+		count++;
+
+	if (fwrite(&count, sizeof(size_t), 1, openfile->journal) != 1)
+		return FALSE;
+
+	for (const linestruct *line = list; line != NULL; line = line->next)
+		if (fwrite(&line->has_anchor, sizeof(bool), 1, openfile->journal) != 1 ||
+					!stow_string(line->data))
+			return FALSE;
+
+	return TRUE;
+}
+
+/* Read a list of lines (possibly NULL) back from the journal. */
+linestruct *fetch_lines(void)
+{
+	linestruct *list = NULL, *line = NULL;
+	size_t count;
+
+	if (fread(&count, sizeof(size_t), 1, openfile->journal) != 1)
+		die(_("Could not read back the undo history: %s\n"), strerror(errno));
+
+	while (count-- > 0) {
+		linestruct *newline = make_new_node(line);
+
+		if (fread(&newline->has_anchor, sizeof(bool), 1, openfile->journal) != 1)
+			die(_("Could not read back the undo history: %s\n"), strerror(errno));
+
+		newline->data = fetch_string();
+
+		if (line == NULL)
+			list = newline;
+		else
+			line->next = newline;
+		line = newline;
+	}
+
+	return list;
+}
+
+/* Move the text of the given undo item out to the journal of the current
+ * buffer, creating that journal when needed.  Return FALSE on failure. */
+bool stow_undo_item(undostruct *u)
+{
+	off_t offset;
+
+	if (openfile->journal == NULL) {
+		char *journalname = safe_tempfile(&openfile->journal);
+
+		if (journalname == NULL)
+			return FALSE;
+
+		/* Nobody else needs the journal, so let it vanish when closed. */
+		unlink(journalname);
+		free(journalname);
+	}
+
+	if (fseeko(openfile->journal, 0, SEEK_END) < 0 ||
+				(offset = ftello(openfile->journal)) < 0)
+		return FALSE;
+
+	if (!stow_string(u->strdata) || !stow_lines(u->cutbuffer))
+		return FALSE;
+
+	for (groupstruct *group = u->grouping; group != NULL; group = group->next) {
+		if (u->type == PATCH && !stow_lines(group->lines))
+			return FALSE;
+		for (ssize_t index = 0; group->indentations != NULL &&
+							index <= group->bottom_line - group->top_line; index++)
+			if (!stow_string(group->indentations[index]))
+				return FALSE;
+	}
+
+	/* Only when everything was written, let go of the text in memory. */
+	free(u->strdata);
+	u->strdata = NULL;
+	free_lines(u->cutbuffer);
+	u->cutbuffer = NULL;
+
+	for (groupstruct *group = u->grouping; group != NULL; group = group->next) {
+		free_chararray(group->indentations, group->bottom_line - group->top_line + 1);
+		group->indentations = NULL;
+		free_lines(group->lines);
+		group->lines = NULL;
+	}
+
+	openfile->undosize -= u->weight;
+	u->weight = 0;
+	u->journaled = offset;
+
+	return TRUE;
+}
+
+/* Cut the journal of the current buffer back to the given size, to reclaim
+ * the space of items that were discarded or read back in -- provided that
+ * no item that is still stowed sits beyond that point. */
+void shorten_journal(off_t size)
+{
+	for (const undostruct *u = openfile->undotop; u != NULL; u = u->next)
+		if (u->journaled >= size)
+			return;
+
+	if (fflush(openfile->journal) == 0)
+		IGNORE_CALL_RESULT(ftruncate(fileno(openfile->journal), size));
+}
+
+/* Read the text of the given undo item back in from the journal. */
+void fetch_undo_item(undostruct *u)
+{
+	off_t offset = u->journaled;
+
+	if (fseeko(openfile->journal, offset, SEEK_SET) < 0)
+		die(_("Could not read back the undo history: %s\n"), strerror(errno));
+
+	u->strdata = fetch_string();
+	u->room = 0;
+	u->cutbuffer = fetch_lines();
+
+	for (groupstruct *group = u->grouping; group != NULL; group = group->next) {
+		size_t number_of_lines = group->bottom_line - group->top_line + 1;
+
+		if (u->type == PATCH) {
+			group->lines = fetch_lines();
+			continue;
+		} else if (group->affected != NULL)
+			continue;
+
+		group->indentations = nmalloc(number_of_lines * sizeof(char *));
+
+		for (size_t index = 0; index < number_of_lines; index++)
+			group->indentations[index] = fetch_string();
+	}
+
+	u->journaled = -1;
+	weigh_undo_item(u);
+
+	shorten_journal(offset);
+}
+
+/* When the undo items of the current buffer hold more text than the budget
+ * allows, move the text of the oldest ones out to the journal, so that only
+ * three quarters of the budget remain in use.  The topmost item is exempt. */
+void keep_undo_within_budget(void)
+{
+	size_t allowance = undobudget * (1024 * 1024 / 4) * 3;
+	size_t kept = 0, count = 0;
+	undostruct *cut, *u, **doomed;
+
+	if (undobudget == 0 || openfile->undosize <= (size_t)undobudget * 1024 * 1024)
+		return;
+
+	/* Find the newest item that does not fit within the allowance. */
+	for (cut = openfile->undotop->next; cut && cut->journaled < 0; cut = cut->next) {
+		kept += cut->weight;
+		if (kept > allowance)
+			break;
+	}
+
+	/* Stored items sit below all others, so stop at the first one. */
+	for (u = cut; u && u->journaled < 0; u = u->next)
+		if (u->weight > 0)
+			count++;
+
+	if (count == 0)
+		return;
+
+	doomed = nmalloc(count * sizeof(undostruct *));
+	count = 0;
+
+	for (u = cut; u && u->journaled < 0; u = u->next)
+		if (u->weight > 0)
+			doomed[count++] = u;
+
+	/* Stow the oldest item first, so that newer items sit further into the
+	 * journal, and the journal can shrink as undoing reads them back in. */
+	while (count > 0 && stow_undo_item(doomed[--count]))
+		;
+
+	free(doomed);
+}
+
+/* Show on the status bar how much text the undo history of the current
+ * buffer holds, in memory and in its journal on disk. */
+void report_undo_usage(void)
+{
+	size_t inmemory = openfile->undosize;
+	size_t items = 0;
+	off_t ondisk = 0;
+
+	for (undostruct *u = openfile->undotop; u != NULL; u = u->next)
+		items++;
+
+	/* The topmost item may have grown since it was last measured. */
+	if (openfile->undotop != NULL)
+		inmemory += weight_of(openfile->undotop) - openfile->undotop->weight;
+
+	if (openfile->journal != NULL && fseeko(openfile->journal, 0, SEEK_END) == 0)
+		ondisk = ftello(openfile->journal);
+
+	statusline(INFO, _("%zu undo items: %zu kB in memory, %zu kB on disk"),
+				items, (inmemory + 1023) / 1024, (size_t)(ondisk + 1023) / 1024);
+}
+
 /* Discard undo items that are newer than the given one, or all if NULL. */
 void discard_until(const undostruct *thisitem)
 {
 	undostruct *dropit = openfile->undotop;
+	off_t lowest = -1;
 	groupstruct *group;
 
 	while (dropit != NULL && dropit != thisitem) {
+		/* Remember from where the dropped items occupy the journal. */
+		if (dropit->journaled >= 0 && (lowest < 0 || dropit->journaled < lowest))
+			lowest = dropit->journaled;
+
 		openfile->undotop = dropit->next;
+		openfile->undosize -= dropit->weight;
 		free(dropit->strdata);
 		free_lines(dropit->cutbuffer);
 		group = dropit->grouping;
@@ -926,6 +1467,8 @@ void discard_until(const undostruct *thisitem)
 			groupstruct *next = group->next;
 			free_chararray(group->indentations,
 								group->bottom_line - group->top_line + 1);
+			free(group->affected);
+			free_lines(group->lines);
 			free(group);
 			group = next;
 		}
@@ -933,6 +1476,9 @@ void discard_until(const undostruct *thisitem)
 		dropit = openfile->undotop;
 	}
 
+	if (lowest >= 0)
+		shorten_journal(lowest);
+
 	/* Adjust the pointer to the top of the undo stack. */
 	openfile->current_undo = (undostruct *)thisitem;
 
@@ -958,6 +1504,9 @@ void add_undo(undo_type action, const char *message)
 	u->newsize = openfile->totsize;
 	u->grouping = NULL;
 	u->xflags = 0;
+	u->room = 0;
+	u->weight = 0;
+	u->journaled = -1;
 
 	/* Blow away any undone items. */
 	discard_until(openfile->current_undo);
@@ -977,6 +1526,12 @@ void add_undo(undo_type action, const char *message)
 		u->next = openfile->undotop;
 		openfile->undotop = u;
 		openfile->current_undo = u;
+
+		/* The item below is complete now, so its size is known. */
+		if (u->next != NULL) {
+			weigh_undo_item(u->next);
+			keep_undo_within_budget();
+		}
 	}
 
 	/* Record the info needed to be able to undo each possible action. */
@@ -1055,8 +1610,6 @@ void add_undo(undo_type action, const char *message)
 			u->xflags |= HAD_ANCHOR_AT_START;
 		break;
 	case PASTE:
-		u->cutbuffer = copy_buffer(cutbuffer);
-		/* Fall-through. */
 	case INSERT:
 		if (thisline == openfile->filebot)
 			u->xflags |= INCLUDED_LAST_LINE;
@@ -1073,6 +1626,7 @@ void add_undo(undo_type action, const char *message)
 	case COMMENT:
 	case UNCOMMENT:
 #endif
+	case PATCH:
 		break;
 	default:
 		die("Bad undo type -- please report a bug\n");
@@ -1081,38 +1635,49 @@ void add_undo(undo_type action, const char *message)
 	openfile->last_action = action;
 }
 
-/* Update a multiline undo item.  This should be called once for each line
- * affected by a multiple-line-altering feature.  The indentation that is
- * added or removed is saved separately for each line in the undo item. */
-void update_multiline_undo(ssize_t lineno, char *indentation)
+/* Give the current undo item a group that spans the lines from top to bot,
+ * sized once for the whole range: with a slot for a string per line when
+ * per_line is TRUE, and otherwise with a cleared bit per line. */
+groupstruct *add_batch_group(linestruct *top, linestruct *bot, bool per_line)
 {
 	undostruct *u = openfile->current_undo;
+	groupstruct *born = nmalloc(sizeof(groupstruct));
+	size_t number_of_lines = bot->lineno - top->lineno + 1;
 
-	/* If there already is a group and the current line is contiguous with it,
-	 * extend the group; otherwise, create a new group. */
-	if (u->grouping && u->grouping->bottom_line + 1 == lineno) {
-		size_t number_of_lines = lineno - u->grouping->top_line + 1;
-
-		u->grouping->bottom_line = lineno;
+	born->top_line = top->lineno;
+	born->bottom_line = bot->lineno;
 
-		u->grouping->indentations = nrealloc(u->grouping->indentations,
-										number_of_lines * sizeof(char *));
-		u->grouping->indentations[number_of_lines - 1] = copy_of(indentation);
+	if (per_line) {
+		born->indentations = nmalloc(number_of_lines * sizeof(char *));
+		born->affected = NULL;
 	} else {
-		groupstruct *born = nmalloc(sizeof(groupstruct));
+		born->indentations = NULL;
+		born->affected = nmalloc((number_of_lines + 7) / 8);
+		memset(born->affected, 0, (number_of_lines + 7) / 8);
+	}
 
-		born->top_line = lineno;
-		born->bottom_line = lineno;
+	born->lines = NULL;
 
-		born->indentations = nmalloc(sizeof(char *));
-		born->indentations[0] = copy_of(indentation);
+	born->next = u->grouping;
+	u->grouping = born;
 
-		born->next = u->grouping;
-		u->grouping = born;
-	}
+	return born;
+}
 
-	/* Store the file size after the change, to be used when redoing. */
-	u->newsize = openfile->totsize;
+/* Note in the given batch group that the given line was changed. */
+void mark_as_affected(groupstruct *group, ssize_t lineno)
+{
+	size_t index = lineno - group->top_line;
+
+	group->affected[index / 8] |= 1 << (index % 8);
+}
+
+/* Return TRUE when the given batch group says the given line was changed. */
+bool was_affected(const groupstruct *group, ssize_t lineno)
+{
+	size_t index = lineno - group->top_line;
+
+	return (group->affected[index / 8] & (1 << (index % 8)));
 }
 
 /* Update an undo item with (among other things) the file size and
@@ -1131,9 +1696,14 @@ void update_undo(undo_type action)
 
 	switch (u->type) {
 	case ADD:
+		/* Append just the newly typed bytes, making room in big steps. */
+		datalen = u->tail_x - u->head_x;
 		newlen = openfile->current_x - u->head_x;
-		u->strdata = nrealloc(u->strdata, newlen + 1);
-		strncpy(u->strdata, openfile->current->data + u->head_x, newlen);
+		if (newlen + 1 > u->room) {
+			u->room = 2 * newlen + 8;
+			u->strdata = nrealloc(u->strdata, u->room);
+		}
+		strncpy(u->strdata + datalen, openfile->current->data + u->tail_x, newlen - datalen);
 		u->strdata[newlen] = '\0';
 		u->tail_x = openfile->current_x;
 		break;
@@ -1174,7 +1744,23 @@ void update_undo(undo_type action)
 	case CUT:
 		if (u->type == ZAP)
 			u->cutbuffer = cutbuffer;
-		else if (cutbuffer != NULL) {
+		else if (cutbuffer != NULL && u->cutbuffer != NULL && keep_cutbuffer) {
+			linestruct *source = cutbuffer, *bottom = u->cutbuffer;
+
+			/* A contiguous cut only appended to the cutbuffer, so our copy
+			 * still matches it up to our last line: refresh just that line
+			 * and copy only the lines that were added after it. */
+			while (bottom->next != NULL) {
+				bottom = bottom->next;
+				source = source->next;
+			}
+			bottom->data = mallocstrcpy(bottom->data, source->data);
+			bottom->has_anchor = source->has_anchor;
+			if (source->next != NULL) {
+				bottom->next = copy_buffer(source->next);
+				bottom->next->prev = bottom;
+			}
+		} else if (cutbuffer != NULL) {
 			free_lines(u->cutbuffer);
 			u->cutbuffer = copy_buffer(cutbuffer);
 		}
@@ -1712,6 +2298,116 @@ void justify_paragraph(linestruct **line, size_t count)
 	free(lead_string);
 }
 
+#ifndef NANO_TINY
+/* Justify all paragraphs of the buffer, one at a time and in place: each
+ * paragraph is justified in a copy, and only when the copy differs does it
+ * replace the original lines, which are then kept in a single PATCH undo item.
+ * Show the progress once a second, and stop between paragraphs on ^C. */
+void justify_all_paragraphs(void)
+{
+	linestruct *line = openfile->filetop, *prior = NULL;
+	groupstruct *lastgroup = NULL;
+	undostruct *u = NULL;
+	time_t lastreport = time(NULL);
+	ssize_t shift = 0;
+	size_t linecount;
+	bool found = FALSE;
+
+	install_handler_for_Ctrl_C();
+	control_C_was_pressed = FALSE;
+
+	while (!control_C_was_pressed && find_paragraph(&line, &linecount)) {
+		linestruct *before = line->prev, *after = line;
+		linestruct *copy = NULL, *tail = NULL, *item;
+		size_t count = 0;
+		bool differs = FALSE;
+
+		found = TRUE;
+
+		/* Make a copy of the paragraph, and justify that. */
+		for (size_t index = 0; index < linecount; index++) {
+			item = make_new_node(tail);
+			item->data = copy_of(after->data);
+			item->has_anchor = after->has_anchor;
+			if (tail == NULL)
+				copy = item;
+			else
+				tail->next = item;
+			tail = item;
+			after = after->next;
+		}
+
+		tail = copy;
+		justify_paragraph(&tail, linecount);
+
+		/* Compare the justified lines with the original ones. */
+		for (item = copy, tail = line; item != NULL; item = item->next, count++) {
+			if (!differs && (count == linecount || strcmp(item->data, tail->data) != 0))
+				differs = TRUE;
+			if (count < linecount)
+				tail = tail->next;
+		}
+
+		if (!differs && count == linecount)
+			free_lines(copy);
+		else {
+			if (u == NULL) {
+				/* TRANSLATORS: This one goes with Undid/Redid messages. */
+				add_undo(COUPLE_BEGIN, N_("justification"));
+				add_undo(PATCH, NULL);
+				u = openfile->undotop;
+				prior = before;
+			}
+
+			record_patch_group(u, &lastgroup, line->lineno + shift,
+								before, linecount, copy, count);
+
+			shift += (ssize_t)count - (ssize_t)linecount;
+		}
+
+		if (after == NULL)
+			break;
+
+		line = after;
+
+		if (time(NULL) > lastreport) {
+			statusline(HUSH, _("Justifying... %zu%%"),
+						(size_t)(100 * line->lineno / openfile->filebot->lineno));
+			lastreport = time(NULL);
+		}
+	}
+
+	restore_handler_for_Ctrl_C();
+
+	openfile->current = openfile->filebot;
+	openfile->current_x = strlen(openfile->filebot->data);
+	openfile->placewewant = xplustabs();
+	refresh_needed = TRUE;
+
+	/* When there was no paragraph at all, just leave the cursor at the end. */
+	if (control_C_was_pressed)
+		statusline(ALERT, _("Interrupted"));
+	else if (found)
+		statusline(REMARK, _("Justified file"));
+
+	if (u == NULL)
+		return;
+
+	u->newsize = openfile->totsize;
+
+	renumber_from((prior != NULL) ? prior : openfile->filetop);
+
+#ifdef ENABLE_COLOR
+	/* The changed lines may alter the state of the multiline regexes. */
+	discard_checkpoints_from((prior != NULL) ? prior : openfile->filetop);
+#endif
+
+	set_modified();
+
+	add_undo(COUPLE_END, N_("justification"));
+}
+#endif /* !NANO_TINY */
+
 #define ONE_PARAGRAPH  FALSE
 #define WHOLE_BUFFER  TRUE
 
@@ -1746,6 +2442,12 @@ void justify_text(bool whole_buffer)
 	size_t secondary_len = 0;
 		/* The length of that later lead. */
 
+	/* Without a mark, the entire buffer is justified paragraph by paragraph. */
+	if (whole_buffer && !openfile->mark) {
+		justify_all_paragraphs();
+		return;
+	}
+
 	/* TRANSLATORS: This one goes with Undid/Redid messages. */
 	add_undo(COUPLE_BEGIN, N_("justification"));
 
@@ -1941,10 +2643,6 @@ void justify_text(bool whole_buffer)
 	}
 
 #ifndef NANO_TINY
-	/* Wipe an anchor on the first paragraph if it was only inherited. */
-	if (whole_buffer && !openfile->mark && !cutbuffer->has_anchor)
-		openfile->current->has_anchor = FALSE;
-
 	add_undo(PASTE, NULL);
 #endif
 	/* Do the equivalent of a paste of the justified text. */
@@ -2018,6 +2716,153 @@ void construct_argument_list(char ***arguments, char *command, char *filename)
 	(*arguments)[count - 1] = NULL;
 }
 
+#ifndef NANO_TINY
+/* Note down the lines of the text that starts at topline, and their fingerprints. */
+void survey_text(versionstruct *text, linestruct *topline)
+{
+	size_t index = 0;
+
+	text->count = 0;
+	for (linestruct *line = topline; line != NULL; line = line->next)
+		text->count++;
+
+	text->lines = nmalloc(text->count * sizeof(linestruct *));
+	text->prints = nmalloc(text->count * sizeof(size_t));
+
+	for (linestruct *line = topline; line != NULL; line = line->next) {
+		text->lines[index] = line;
+		text->prints[index++] = fingerprint_of(line->data);
+	}
+}
+
+/* Return TRUE when the given line of the old text equals the given line of the new one. */
+bool same_line(const versionstruct *was, size_t i, const versionstruct *now, size_t j)
+{
+	return (was->prints[i] == now->prints[j] &&
+				strcmp(was->lines[i]->data, now->lines[j]->data) == 0);
+}
+
+/* Return TRUE when the old text from line i on and the new text from line j
+ * on agree for PATCH_RUN lines, or agree until both of them end. */
+bool texts_agree(const versionstruct *was, size_t i, const versionstruct *now, size_t j)
+{
+	for (int step = 0; step < PATCH_RUN; step++, i++, j++) {
+		if (i == was->count && j == now->count)
+			return TRUE;
+		if (i == was->count || j == now->count || !same_line(was, i, now, j))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Turn the current buffer into the text that starts at topline, by replacing
+ * only the runs of lines that differ, so that all other lines keep their
+ * anchors and coloring state.  Each replacement becomes a group of a single
+ * PATCH undo item, which is wrapped in a couple.  Return FALSE when nothing
+ * differs.  The given text is used up. */
+bool patch_buffer(linestruct *topline, const char *operation)
+{
+	linestruct *before = NULL, *bottom = topline, *prior = NULL;
+	groupstruct *lastgroup = NULL;
+	undostruct *u = NULL;
+	ssize_t shift = 0;
+	versionstruct was, now;
+	size_t i = 0, j = 0;
+
+	/* When the new text does not end with a newline, and it should, add one. */
+	while (bottom->next != NULL)
+		bottom = bottom->next;
+
+	if (!ISSET(NO_NEWLINES) && bottom->data[0] != '\0') {
+		bottom->next = make_new_node(bottom);
+		bottom->next->data = copy_of("");
+	}
+
+	survey_text(&was, openfile->filetop);
+	survey_text(&now, topline);
+
+	while (i < was.count || j < now.count) {
+		size_t gone = was.count - i, come = now.count - j;
+		linestruct *list = NULL;
+		bool found = FALSE;
+
+		/* Step over a line that stayed the same, discarding its new copy. */
+		if (i < was.count && j < now.count && same_line(&was, i, &now, j)) {
+			before = was.lines[i++];
+			delete_node(now.lines[j++]);
+			continue;
+		}
+
+		/* Find the nearest point where the two texts agree again. */
+		for (size_t reach = 1; reach <= PATCH_REACH && !found; reach++)
+			for (size_t x = 0; x <= reach && !found; x++)
+				if (i + x <= was.count && j + reach - x <= now.count &&
+								texts_agree(&was, i + x, &now, j + reach - x)) {
+					gone = x;
+					come = reach - x;
+					found = TRUE;
+				}
+
+		/* When there is no such point nearby, replace a chunk and look again. */
+		if (!found) {
+			gone = (gone < PATCH_REACH) ? gone : PATCH_REACH;
+			come = (come < PATCH_REACH) ? come : PATCH_REACH;
+		}
+
+		/* Detach the differing new lines from the rest of the new text. */
+		if (come > 0) {
+			list = now.lines[j];
+			list->prev = NULL;
+			now.lines[j + come - 1]->next = NULL;
+		}
+
+		if (u == NULL) {
+			add_undo(COUPLE_BEGIN, operation);
+			add_undo(PATCH, NULL);
+			u = openfile->undotop;
+			prior = before;
+		}
+
+		record_patch_group(u, &lastgroup, i + shift + 1, before, gone, list, come);
+
+		if (come > 0)
+			before = now.lines[j + come - 1];
+
+		i += gone;
+		j += come;
+		shift += (ssize_t)come - (ssize_t)gone;
+	}
+
+	free(was.lines);
+	free(was.prints);
+	free(now.lines);
+	free(now.prints);
+
+	if (u == NULL)
+		return FALSE;
+
+	u->newsize = openfile->totsize;
+
+	renumber_from(openfile->filetop);
+
+#ifdef ENABLE_COLOR
+	/* The changed lines may alter the state of the multiline regexes. */
+	discard_checkpoints_from((prior != NULL) ? prior : openfile->filetop);
+#endif
+
+	openfile->current = openfile->filetop;
+	openfile->current_x = 0;
+
+	set_modified();
+	refresh_needed = TRUE;
+
+	add_undo(COUPLE_END, operation);
+
+	return TRUE;
+}
+#endif /* !NANO_TINY */
+
 /* Open the specified file, and if that succeeds, remove the text of the marked
  * region or of the entire buffer and read the file contents into its place. */
 bool replace_buffer(const char *filename, undo_type action, const char *operation)
@@ -2031,6 +2876,16 @@ bool replace_buffer(const char *filename, undo_type action, const char *operatio
 	if (descriptor < 0)
 		return FALSE;
 
+#ifndef NANO_TINY
+	/* When replacing the entire buffer, change just the lines that differ. */
+	if (action == CUT_TO_EOF) {
+		format_type format;
+		size_t count;
+
+		return patch_buffer(read_lines(stream, &count, &format), operation);
+	}
+#endif
+
 	cutbuffer = NULL;
 
 #ifndef NANO_TINY
@@ -2052,6 +2907,8 @@ bool replace_buffer(const char *filename, undo_type action, const char *operatio
 	read_file(stream, descriptor, filename, TRUE);
 
 #ifndef NANO_TINY
+	openfile->filetop->has_anchor = FALSE;
+	openfile->anchors_listed = FALSE;
 	add_undo(COUPLE_END, operation);
 #endif
 	return TRUE;
@@ -2168,12 +3025,10 @@ void treat(char *tempfile_name, char *theprogram, bool spelling)
 	if (was_at_eol || openfile->current_x > strlen(openfile->current->data))
 		openfile->current_x = strlen(openfile->current->data);
 
-	if (replaced) {
 #ifndef NANO_TINY
-		openfile->filetop->has_anchor = FALSE;
+	if (replaced)
 		update_undo(COUPLE_END);
 #endif
-	}
 
 	openfile->placewewant = was_pww;
 	adjust_viewport(STATIONARY);
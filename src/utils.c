@@ -362,6 +362,158 @@ size_t get_page_start(size_t column)
 		return column - (editwincols - 2);
 }
 
+#ifndef NANO_TINY
+/* The column indexes of the most recently measured long lines. */
+static columnindexstruct indexes[COLUMNINDEXES];
+/* Which of those indexes gets replaced next. */
+static int next_to_replace = 0;
+/* The line whose index was trimmed for an edit that is not yet finished. */
+static const linestruct *spared_line = NULL;
+
+/* Return the line of the current buffer that the given text belongs to, when
+ * this is the current line or a line in the edit window, and NULL otherwise.
+ * Only such lines get a column index, as only their edits are tracked. */
+const linestruct *line_holding(const char *text)
+{
+	const linestruct *line;
+
+	if (openfile == NULL || openfile->current == NULL)
+		return NULL;
+
+	if (openfile->current->data == text)
+		return openfile->current;
+
+	line = openfile->edittop;
+	for (int row = 0; line != NULL && row < editwinrows; row++, line = line->next)
+		if (line->data == text)
+			return line;
+
+	return NULL;
+}
+
+/* Forget the column indexes of the lines from top to bot, or of all lines
+ * when top is NULL, because their text has changed.  An index that was just
+ * trimmed for the edit that is being finished is spared. */
+void forget_column_indexes(const linestruct *top, const linestruct *bot)
+{
+	for (int slot = 0; slot < COLUMNINDEXES; slot++)
+		if (indexes[slot].line != NULL && (top == NULL || indexes[slot].line == top ||
+					(top->lineno <= indexes[slot].line->lineno &&
+					indexes[slot].line->lineno <= bot->lineno)) &&
+					(top == NULL || indexes[slot].line != spared_line))
+			indexes[slot].line = NULL;
+
+	spared_line = NULL;
+}
+
+/* Drop the checkpoints in the column index of the given line that lie beyond
+ * the given offset, as the text of the line was changed from there onward;
+ * the checkpoints before it depend only on the text before them. */
+void trim_column_index(const linestruct *line, size_t offset)
+{
+	for (int slot = 0; slot < COLUMNINDEXES; slot++)
+		if (indexes[slot].line == line) {
+			columnindexstruct *index = &indexes[slot];
+
+			while (index->count > 1 && index->offsets[index->count - 1] > offset)
+				index->count--;
+
+			/* The text may have been moved elsewhere in memory. */
+			index->text = line->data;
+			spared_line = line;
+		}
+}
+
+/* Return the byte offset of the last checkpoint in the column index of the
+ * given text that lies before offset maxlen and at or before the given
+ * column, and put the column of that checkpoint in *column_at.  Missing
+ * checkpoints get added.  When the text is short, or is not the text of
+ * a line whose edits cause its index to be forgotten, zero is returned. */
+size_t nearest_checkpoint(const char *text, size_t maxlen, size_t column,
+							size_t *column_at)
+{
+	columnindexstruct *index = NULL;
+	size_t low, high;
+
+	for (int slot = 0; slot < COLUMNINDEXES; slot++)
+		if (indexes[slot].line != NULL && indexes[slot].text == text &&
+					indexes[slot].line->data == text && indexes[slot].tabsize == tabsize)
+			index = &indexes[slot];
+
+	if (index == NULL) {
+		const linestruct *line;
+
+		if (strnlen(text, LONG_LINE) < LONG_LINE || (line = line_holding(text)) == NULL) {
+			*column_at = 0;
+			return 0;
+		}
+
+		index = &indexes[next_to_replace];
+		next_to_replace = (next_to_replace + 1) % COLUMNINDEXES;
+
+		if (index->room == 0) {
+			index->room = 64;
+			index->offsets = nmalloc(index->room * sizeof(size_t));
+			index->columns = nmalloc(index->room * sizeof(size_t));
+			index->offsets[0] = 0;
+			index->columns[0] = 0;
+		}
+
+		index->line = line;
+		index->text = text;
+		index->tabsize = tabsize;
+		index->count = 1;
+	}
+
+	/* Find the last checkpoint that lies before maxlen and not beyond column. */
+	low = 0;
+	high = index->count - 1;
+
+	while (low < high) {
+		size_t middle = (low + high + 1) / 2;
+
+		if (index->offsets[middle] < maxlen && index->columns[middle] <= column)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+
+	/* When it is the last checkpoint, add more, until one is beyond. */
+	if (low == index->count - 1) {
+		size_t offset = index->offsets[low];
+		size_t width = index->columns[low];
+
+		while (offset < maxlen && width <= column && text[offset] != '\0') {
+			size_t target = offset + COLUMN_STRIDE;
+
+			while (offset < target && text[offset] != '\0')
+				offset += advance_over(text + offset, &width);
+
+			if (offset < target)
+				break;
+
+			if (index->count == index->room) {
+				index->room *= 2;
+				index->offsets = nrealloc(index->offsets, index->room * sizeof(size_t));
+				index->columns = nrealloc(index->columns, index->room * sizeof(size_t));
+			}
+
+			index->offsets[index->count] = offset;
+			index->columns[index->count++] = width;
+		}
+
+		low = index->count - 1;
+
+		if (index->offsets[low] >= maxlen || index->columns[low] > column)
+			low--;
+	}
+
+	*column_at = index->columns[low];
+
+	return index->offsets[low];
+}
+#endif
+
 /* Return the placewewant associated with current_x, i.e. the zero-based
  * column position of the cursor. */
 size_t xplustabs(void)
@@ -378,7 +530,22 @@ size_t actual_x(const char *text, size_t column)
 	size_t width = 0;
 		/* The current accumulated span, in columns. */
 
+#ifndef NANO_TINY
+	/* On a long line, start walking from the nearest checkpoint. */
+	if (column >= LONG_LINE)
+		text += nearest_checkpoint(text, (size_t)-1, column, &width);
+#endif
+
 	while (*text != '\0') {
+		/* Step over plain ASCII in one go, as far as the column allows. */
+		size_t run = ascii_run(text, column - width);
+
+		text += run;
+		width += run;
+
+		if (*text == '\0')
+			break;
+
 		int charlen = advance_over(text, &width);
 
 		if (width > column)
@@ -399,8 +566,32 @@ size_t wideness(const char *text, size_t maxlen)
 	if (maxlen == 0)
 		return 0;
 
+#ifndef NANO_TINY
+	/* On a long line, start walking from the nearest checkpoint. */
+	if (maxlen >= LONG_LINE) {
+		size_t offset = nearest_checkpoint(text, maxlen, (size_t)-1, &width);
+
+		text += offset;
+		maxlen -= offset;
+	}
+#endif
+
 	while (*text != '\0') {
-		size_t charlen = advance_over(text, &width);
+		/* Step over plain ASCII in one go, one column per byte. */
+		size_t run = ascii_run(text, maxlen);
+		size_t charlen;
+
+		if (maxlen <= run)
+			return width + maxlen;
+
+		maxlen -= run;
+		text += run;
+		width += run;
+
+		if (*text == '\0')
+			break;
+
+		charlen = advance_over(text, &width);
 
 		if (maxlen <= charlen)
 			break;
@@ -417,8 +608,21 @@ size_t breadth(const char *text)
 {
 	size_t span = 0;
 
-	while (*text != '\0')
-		text += advance_over(text, &span);
+#ifndef NANO_TINY
+	/* On a long line, start walking from the last checkpoint. */
+	if (strnlen(text, LONG_LINE) == LONG_LINE)
+		text += nearest_checkpoint(text, (size_t)-1, (size_t)-1, &span);
+#endif
+
+	while (*text != '\0') {
+		size_t run = ascii_run(text, (size_t)-1);
+
+		text += run;
+		span += run;
+
+		if (*text != '\0')
+			text += advance_over(text, &span);
+	}
 
 	return span;
 }
@@ -23,10 +23,16 @@
 #include "revision.h"
 
 #include <ctype.h>
+#include <errno.h>
 #ifdef __linux__
+#include <fcntl.h>
 #include <sys/ioctl.h>
 #endif
 #include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <unistd.h>
+#endif
 #ifdef ENABLE_UTF8
 #include <wchar.h>
 #endif
@@ -46,12 +52,22 @@ static int *key_buffer = NULL;
 		/* A buffer for the keystrokes that haven't been handled yet. */
 static size_t key_buffer_len = 0;
 		/* The length of the keystroke buffer. */
+static int *key_store = NULL;
+		/* The block of memory in which the keystroke buffer lives. */
+static size_t key_room = 0;
+		/* How many key codes fit in that block. */
 static int digit_count = 0;
 		/* How many digits of a three-digit character code we've eaten. */
 static bool reveal_cursor = FALSE;
 		/* Whether the cursor should be shown when waiting for input. */
 static bool linger_after_escape = FALSE;
 		/* Whether to give ncurses some time to get the next code. */
+#ifndef NANO_TINY
+static bool painting_postponed = FALSE;
+		/* Whether the repainting of the edit window was put off. */
+static chunkmapstruct chunkmaps[CHUNKMAPS];
+		/* Where the chunks of the most recently mapped long lines begin. */
+#endif
 static int statusblank = 0;
 		/* The number of keystrokes left before we blank the status bar. */
 size_t from_x = 0;
@@ -62,7 +78,46 @@ static bool has_more = FALSE;
 		/* Whether the current line has more text after the displayed part. */
 static bool is_shorter = TRUE;
 		/* Whether a row's text is narrower than the screen's width. */
+static rowstruct *rowmap = NULL;
+		/* What each row of the edit window currently shows. */
+static int rowmap_size = 0;
+		/* The number of rows that the above map describes. */
+#ifdef ENABLE_COLOR
+static clock_t color_deadline = 0;
+		/* The moment after which no more coloring is done in this update. */
+static bool amid_refresh = FALSE;
+		/* Whether edit_refresh() is in the process of drawing all rows. */
+static bool coloring_curtailed = FALSE;
+		/* Whether some line was left uncolored, to stay within the budget. */
+#endif
+
 #ifndef NANO_TINY
+static tracetype *traces = NULL;
+		/* The latency tallies for the functions that keystrokes invoked. */
+static tracetype overall;
+		/* The latency tally for all keystrokes together. */
+static tracetype *traced = NULL;
+		/* The tally that the keystroke being handled will be charged to. */
+static unsigned long long arrived = 0;
+		/* When the earliest keystroke that is not yet shown came in. */
+static unsigned long long dispatched = 0;
+		/* When the first of the not yet shown keystrokes was dispatched. */
+static unsigned long long painted = 0;
+		/* When the last row was drawn for those keystrokes. */
+static size_t rows_drawn = 0;
+		/* How many rows were drawn since the previous keystrokes were shown. */
+static size_t rows_scrolled = 0;
+		/* How many times the edit window was scrolled since then. */
+static size_t bars_drawn = 0;
+		/* How many title bars, minibars, and help lines were drawn. */
+#ifdef __linux__
+static int iostats = -1;
+		/* The descriptor of the file that tells how much nano has written. */
+static size_t bytes_before = 0;
+		/* How many bytes had been written when keystrokes were last shown. */
+#endif
+static size_t bytes_sent = 0;
+		/* How many bytes were written since the previous keystrokes were shown. */
 static size_t sequel_column = 0;
 		/* The starting column of the next chunk when softwrapping. */
 static bool recording = FALSE;
@@ -71,7 +126,31 @@ static int *macro_buffer = NULL;
 		/* A buffer where the recorded key codes are stored. */
 static size_t macro_length = 0;
 		/* The current length of the macro. */
+#endif
+
+/* Make sure that there is room for the given number of extra key codes
+ * at the end of the keystroke buffer.  The space of codes that were
+ * already taken from the head of the buffer is reclaimed only now,
+ * so that taking a code does not require moving all the others. */
+static void reserve_keys(size_t extra)
+{
+	size_t taken = key_buffer - key_store;
 
+	if (taken + key_buffer_len + extra <= key_room)
+		return;
+
+	if (taken > 0 && key_buffer_len > 0)
+		memmove(key_store, key_buffer, key_buffer_len * sizeof(int));
+
+	if (key_buffer_len + extra > key_room) {
+		key_room = 2 * (key_buffer_len + extra);
+		key_store = nrealloc(key_store, key_room * sizeof(int));
+	}
+
+	key_buffer = key_store;
+}
+
+#ifndef NANO_TINY
 /* Add the given code to the macro buffer. */
 void add_to_macrobuffer(int code)
 {
@@ -120,7 +199,9 @@ void run_macro(void)
 		return;
 	}
 
-	key_buffer = nrealloc(key_buffer, macro_length * sizeof(int));
+	key_buffer = key_store;
+	key_buffer_len = 0;
+	reserve_keys(macro_length);
 	key_buffer_len = macro_length;
 
 	for (size_t i = 0; i < macro_length; i++)
@@ -172,6 +253,277 @@ void run_macro(void)
  * - F10 on FreeBSD console == PageUp on Mach console; the former is
  *   omitted.  (Same as above.) */
 
+#ifndef NANO_TINY
+/* Return the current time of the monotonic clock, in nanoseconds. */
+static unsigned long long nanoseconds_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+#ifdef __linux__
+/* Return how many bytes nano has written so far, mostly to the terminal, as
+ * counted by the kernel -- ncurses writes straight to the file descriptor,
+ * so there is no stream to interpose.  Return zero when the count is not
+ * available. */
+static size_t bytes_written(void)
+{
+	char buffer[256], *wchar;
+	ssize_t got;
+
+	if (iostats == -1)
+		iostats = open("/proc/self/io", O_RDONLY);
+
+	if (iostats < 0)
+		return 0;
+
+	got = pread(iostats, buffer, sizeof(buffer) - 1, 0);
+	if (got <= 0)
+		return 0;
+
+	buffer[got] = '\0';
+	wchar = strstr(buffer, "wchar: ");
+
+	return (wchar == NULL) ? 0 : strtoull(wchar + 7, NULL, 10);
+}
+#endif
+
+/* Return the slot of a latency histogram that the given time belongs in. */
+static int slot_for(unsigned long long time)
+{
+	int power = 8;
+
+	if (time < 1024)
+		return 0;
+
+	/* Find the power of two that leaves two significant bits below the top. */
+	while ((time >> power) > 7)
+		power++;
+
+	if (1 + (power - 8) * 4 + (int)(time >> power) - 4 >= LATENCY_BUCKETS)
+		return LATENCY_BUCKETS - 1;
+
+	return 1 + (power - 8) * 4 + (int)(time >> power) - 4;
+}
+
+/* Return the upper limit of the times that fall into the given slot. */
+static unsigned long long ceiling_of(int slot)
+{
+	if (slot == 0)
+		return 1024;
+
+	return (unsigned long long)(4 + (slot - 1) % 4 + 1) << (8 + (slot - 1) / 4);
+}
+
+/* Return (an estimate of) the given percentile of the latencies in the
+ * given tally, in nanoseconds. */
+static unsigned long long percentile(const tracetype *tally, int percent)
+{
+	size_t wanted = (tally->count * percent + 99) / 100;
+	size_t seen = 0;
+
+	for (int slot = 0; slot < LATENCY_BUCKETS; slot++) {
+		seen += tally->buckets[slot];
+		if (seen > 0 && seen >= wanted)
+			return (ceiling_of(slot) < tally->longest) ? ceiling_of(slot) : tally->longest;
+	}
+
+	return tally->longest;
+}
+
+/* Note that a keystroke is being dispatched to the given shortcut (or is
+ * typed text, when shortcut is NULL), and find the tally to charge it to. */
+void trace_dispatch(const keystruct *shortcut)
+{
+	void (*func)(void) = (shortcut == NULL) ? NULL : shortcut->func;
+
+	if (dispatched == 0)
+		dispatched = nanoseconds_now();
+
+	for (traced = traces; traced != NULL; traced = traced->next)
+		if (traced->func == func)
+			return;
+
+	traced = nmalloc(sizeof(tracetype));
+	memset(traced, 0, sizeof(tracetype));
+
+	traced->func = func;
+	traced->name = (func == NULL) ? _("Typing") : _("Other");
+
+	for (funcstruct *f = allfuncs; f != NULL && func != NULL; f = f->next)
+		if (f->func == func) {
+			traced->name = _(f->desc);
+			break;
+		}
+
+	traced->next = traces;
+	traces = traced;
+}
+
+/* Add the given stretches of time to the given tally, and the drawing
+ * that was done since the previous keystrokes were shown. */
+static void add_to_tally(tracetype *tally, unsigned long long *stretch)
+{
+	unsigned long long total = stretch[WAITING] + stretch[HANDLING] + stretch[OUTPUTTING];
+
+	tally->count++;
+	tally->buckets[slot_for(total)]++;
+
+	for (int phase = WAITING; phase <= OUTPUTTING; phase++)
+		tally->nanoseconds[phase] += stretch[phase];
+
+	if (total > tally->longest)
+		tally->longest = total;
+
+	tally->rows += rows_drawn;
+	tally->scrolls += rows_scrolled;
+	tally->bars += bars_drawn;
+	tally->bytes += bytes_sent;
+}
+
+/* Charge the time since the arrival of the keystrokes that have just been
+ * shown to the function they invoked (and to the overall tally), where
+ * flushing is the moment that the output to the terminal began. */
+static void tally_latency(unsigned long long flushing)
+{
+	unsigned long long now = nanoseconds_now();
+	unsigned long long stretch[3];
+#ifdef __linux__
+	size_t bytes_now = bytes_written();
+
+	bytes_sent = bytes_now - bytes_before;
+	bytes_before = bytes_now;
+#endif
+
+	if (dispatched > 0 && traced != NULL) {
+		if (arrived == 0 || arrived > dispatched)
+			arrived = dispatched;
+		if (painted < dispatched)
+			painted = flushing;
+
+		stretch[WAITING] = dispatched - arrived;
+		stretch[HANDLING] = painted - dispatched;
+		stretch[OUTPUTTING] = now - painted;
+
+		add_to_tally(traced, stretch);
+		add_to_tally(&overall, stretch);
+	}
+
+	arrived = dispatched = painted = 0;
+	rows_drawn = rows_scrolled = bars_drawn = 0;
+	bytes_sent = 0;
+}
+
+/* Show on the status bar the median, the 99th percentile, and the maximum
+ * of the time between the arrival of a keystroke and the display of its
+ * effect, the bytes written per keystroke (when they are counted), plus
+ * the function that has the worst 99th percentile. */
+void report_latency(void)
+{
+	const tracetype *slowest = traces;
+
+	if (overall.count == 0) {
+		statusline(AHEM, _("No keystrokes were traced yet"));
+		return;
+	}
+
+	for (const tracetype *tally = traces; tally != NULL; tally = tally->next)
+		if (tally->count > 0 && percentile(tally, 99) > percentile(slowest, 99))
+			slowest = tally;
+
+#ifdef __linux__
+	statusline(INFO, _("%zu keys: p50 %.1f, p99 %.1f, max %.1f ms, %.0f bytes/key; "
+				"slowest: %s (%.1f ms)"), overall.count, percentile(&overall, 50) / 1e6,
+				percentile(&overall, 99) / 1e6, overall.longest / 1e6,
+				(double)overall.bytes / overall.count,
+				slowest->name, percentile(slowest, 99) / 1e6);
+#else
+	statusline(INFO, _("%zu keys: p50 %.1f, p99 %.1f, max %.1f ms; slowest: %s (%.1f ms)"),
+				overall.count, percentile(&overall, 50) / 1e6,
+				percentile(&overall, 99) / 1e6, overall.longest / 1e6,
+				slowest->name, percentile(slowest, 99) / 1e6);
+#endif
+}
+
+/* Order two tallies by decreasing 99th percentile. */
+int worst_first(const void *one, const void *two)
+{
+	unsigned long long first = percentile(*(const tracetype **)one, 99);
+	unsigned long long second = percentile(*(const tracetype **)two, 99);
+
+	return (first < second) ? 1 : (first > second) ? -1 : 0;
+}
+
+/* Write one line of the latency log, for the given tally. */
+static void write_tally(FILE *stream, const tracetype *tally, const char *name)
+{
+	fprintf(stream, "%9zu %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %7.1f %7.2f %7.2f",
+				tally->count, percentile(tally, 50) / 1e6, percentile(tally, 99) / 1e6,
+				tally->longest / 1e6,
+				tally->nanoseconds[WAITING] / 1e6 / tally->count,
+				tally->nanoseconds[HANDLING] / 1e6 / tally->count,
+				tally->nanoseconds[OUTPUTTING] / 1e6 / tally->count,
+				(double)tally->rows / tally->count, (double)tally->scrolls / tally->count,
+				(double)tally->bars / tally->count);
+#ifdef __linux__
+	fprintf(stream, " %9.1f", (double)tally->bytes / tally->count);
+#endif
+	fprintf(stream, "  %s\n", name);
+}
+
+/* Write the latencies of the keystrokes so far to the latency log, for all
+ * keystrokes together and then per function, worst function first.
+ * Return FALSE when the file could not be written. */
+bool write_latency_log(void)
+{
+	tracetype **sorted;
+	size_t count = 0, index = 0;
+	char *fullname;
+	FILE *stream;
+
+	if (latencylog == NULL)
+		return TRUE;
+
+	fullname = real_dir_from_tilde(latencylog);
+	stream = fopen(fullname, "wb");
+	free(fullname);
+
+	if (stream == NULL)
+		return FALSE;
+
+	for (tracetype *tally = traces; tally != NULL; tally = tally->next)
+		count++;
+
+	sorted = nmalloc((count + 1) * sizeof(tracetype *));
+
+	for (tracetype *tally = traces; tally != NULL; tally = tally->next)
+		sorted[index++] = tally;
+
+	qsort(sorted, count, sizeof(tracetype *), worst_first);
+
+	fprintf(stream, "%9s %9s %9s %9s %9s %9s %9s %7s %7s %7s", "keys", "p50 ms",
+				"p99 ms", "max ms", "waiting", "handling", "output", "rows",
+				"scrolls", "bars");
+#ifdef __linux__
+	fprintf(stream, " %9s", "bytes");
+#endif
+	fprintf(stream, "  %s\n", "function");
+
+	if (overall.count > 0)
+		write_tally(stream, &overall, "(all)");
+
+	for (index = 0; index < count; index++)
+		write_tally(stream, sorted[index], sorted[index]->name);
+
+	free(sorted);
+
+	return (fclose(stream) == 0);
+}
+#endif /* !NANO_TINY */
+
 /* Read in a sequence of keystrokes from the given window and save them
  * in the keystroke buffer. */
 void read_keys_from(WINDOW *win)
@@ -182,9 +534,20 @@ void read_keys_from(WINDOW *win)
 	bool timed = FALSE;
 #endif
 
+#ifndef NANO_TINY
+	unsigned long long flushing = (dispatched > 0) ? nanoseconds_now() : 0;
+#endif
+
 	/* Before reading the first keycode, display any pending screen updates. */
 	doupdate();
 
+#ifndef NANO_TINY
+	/* Unless the edit window still has to be redrawn for them, the keystrokes
+	 * that were handled since the previous wait are now fully shown. */
+	if (!refresh_needed || currmenu != MMAIN)
+		tally_latency(flushing);
+#endif
+
 	if (reveal_cursor && (!spotlighted || ISSET(SHOW_CURSOR) || currmenu == MSPELL) &&
 						(LINES > 1 || lastmessage <= HUSH))
 		curs_set(1);
@@ -208,6 +571,17 @@ void read_keys_from(WINDOW *win)
 			regenerate_screen();
 			input = KEY_WINCH;
 		}
+#endif
+#ifdef ENABLE_COLOR
+		/* When asked for it (with SIGUSR1), write out the coloring profile. */
+		if (profile_requested) {
+			profile_requested = FALSE;
+			if (!write_color_profile())
+				statusline(ALERT, _("Could not write coloring profile: %s"),
+											strerror(errno));
+		}
+#endif
+#ifndef NANO_TINY
 
 		if (timed) {
 			timed = FALSE;
@@ -240,10 +614,24 @@ void read_keys_from(WINDOW *win)
 			die(_("Too many errors from stdin\n"));
 	}
 
-	curs_set(0);
+#ifndef NANO_TINY
+	/* Remember when the earliest of the keystrokes to be handled came in. */
+	if (arrived == 0)
+		arrived = nanoseconds_now();
+
+#endif
+	/* Hide the cursor while the screen gets updated, except for a typed
+	 * character or an arrow key in the edit window: those cause only small
+	 * updates, and hiding and showing the cursor would be a large part of
+	 * the output they cause -- which matters over a slow connection. */
+	if (currmenu != MMAIN || !((0x20 <= input && input < DEL_CODE) ||
+				input == KEY_UP || input == KEY_DOWN ||
+				input == KEY_LEFT || input == KEY_RIGHT))
+		curs_set(0);
 
 	/* Initiate the keystroke buffer, and save the keycode in it. */
-	key_buffer = nrealloc(key_buffer, sizeof(int));
+	key_buffer = key_store;
+	reserve_keys(1);
 	key_buffer[0] = input;
 	key_buffer_len = 1;
 
@@ -279,14 +667,17 @@ void read_keys_from(WINDOW *win)
 			break;
 
 		/* Extend the keystroke buffer, and save the keycode at its end. */
-		key_buffer_len++;
-		key_buffer = nrealloc(key_buffer, key_buffer_len * sizeof(int));
-		key_buffer[key_buffer_len - 1] = input;
+		reserve_keys(1);
+		key_buffer[key_buffer_len++] = input;
 	}
 
 	/* Restore blocking-input mode. */
 	nodelay(win, FALSE);
 
+	/* When more than one keystroke came in, hide the cursor anyway. */
+	if (key_buffer_len > 1)
+		curs_set(0);
+
 #ifdef DEBUG
 	fprintf(stderr, "\nSequence of hex codes:");
 	for (size_t i = 0; i < key_buffer_len; i++)
@@ -301,6 +692,59 @@ size_t get_key_buffer_len(void)
 	return key_buffer_len;
 }
 
+#ifndef NANO_TINY
+/* Return TRUE when keystrokes are waiting to be handled, either in the
+ * keystroke buffer or in the terminal, after waiting at most the given
+ * number of milliseconds for one to arrive.  This detects bursts of input
+ * (an unbracketed paste, or fast auto-repeat) that arrive in pieces. */
+bool keys_are_waiting(int milliseconds)
+{
+	int input;
+
+	if (key_buffer_len > 0)
+		return TRUE;
+
+	wtimeout(edit, milliseconds);
+	input = wgetch(edit);
+	wtimeout(edit, -1);
+
+	if (input == ERR)
+		return FALSE;
+
+	/* Let the regular routine read in the code plus any that follow it. */
+	ungetch(input);
+	read_keys_from(edit);
+
+	return TRUE;
+}
+#endif
+
+#ifndef NANO_TINY
+/* Move the run of plain codes (bytes that can be pasted as text, and tabs)
+ * at the head of the keystroke buffer into the given array, without passing
+ * them through the parser.  Stop at the first other code (a line break, or
+ * an ESC that may start the end-of-paste sequence) or when room is filled.
+ * Return the number of codes that were moved. */
+size_t take_plain_codes(char *target, size_t room)
+{
+	size_t count = 0;
+
+	while (count < room && count < key_buffer_len) {
+		int code = key_buffer[count];
+
+		if ((code < 0x20 && code != '\t') || code == DEL_CODE || code > 0xFF)
+			break;
+
+		target[count++] = (char)code;
+	}
+
+	key_buffer += count;
+	key_buffer_len -= count;
+
+	return count;
+}
+#endif
+
 /* Add the given keycode to the front of the keystroke buffer. */
 void put_back(int keycode)
 {
@@ -308,14 +752,17 @@ void put_back(int keycode)
 	if (key_buffer_len + 1 < key_buffer_len)
 		return;
 
-	/* Extend the keystroke buffer to make room for the extra keycode. */
-	key_buffer = nrealloc(key_buffer, ++key_buffer_len * sizeof(int));
-
-	/* If the keystroke buffer wasn't empty before, move all the
-	 * existing content one step further away. */
-	if (key_buffer_len > 1)
-		memmove(key_buffer + 1, key_buffer, (key_buffer_len - 1) * sizeof(int));
+	/* When a code was taken from the head of the buffer, reuse its place;
+	 * otherwise move all the existing content one step further away. */
+	if (key_buffer > key_store)
+		key_buffer--;
+	else {
+		reserve_keys(1);
+		if (key_buffer_len > 0)
+			memmove(key_buffer + 1, key_buffer, key_buffer_len * sizeof(int));
+	}
 
+	key_buffer_len++;
 	*key_buffer = keycode;
 }
 
@@ -337,18 +784,22 @@ int get_input(WINDOW *win)
 {
 	int input;
 
-	if (key_buffer_len == 0 && win != NULL)
+	if (key_buffer_len == 0 && win != NULL) {
+#ifndef NANO_TINY
+		/* When a burst of keystrokes ended in a prompt, first do the
+		 * repainting of the edit window that was put off. */
+		if (painting_postponed && refresh_needed)
+			edit_refresh();
+#endif
 		read_keys_from(win);
+	}
 
 	if (key_buffer_len == 0)
 		return ERR;
 
 	/* Take the first code from the head of the keystroke buffer. */
-	input = key_buffer[0];
-
-	/* If the buffer contains more codes, move them to the front. */
-	if (--key_buffer_len > 0)
-		memmove(key_buffer, key_buffer + 1, key_buffer_len * sizeof(int));
+	input = *(key_buffer++);
+	key_buffer_len--;
 
 	return input;
 }
@@ -845,7 +1296,7 @@ int parse_escape_sequence(int starter)
 
 	/* Remove the consumed sequence bytes from the keystroke buffer. */
 	key_buffer_len -= consumed;
-	memmove(key_buffer, key_buffer + consumed, key_buffer_len * sizeof(int));
+	key_buffer += consumed;
 
 	return keycode;
 }
@@ -1670,6 +2121,8 @@ void blank_edit(void)
 {
 	for (int row = 0; row < editwinrows; row++)
 		blank_row(edit, row);
+
+	invalidate_rows();
 }
 
 /* Blank the first line of the bottom portion of the screen. */
@@ -1734,9 +2187,9 @@ char *display_string(const char *text, size_t column, size_t span,
 {
 	const char *origin = text;
 		/* The beginning of the text, to later determine the covered part. */
-	size_t start_x = actual_x(text, column);
+	size_t start_x = 0;
 		/* The index of the first character that the caller wishes to show. */
-	size_t start_col = wideness(text, start_x);
+	size_t start_col = 0;
 		/* The actual column where that first character starts. */
 	size_t stowaways = 20;
 		/* The number of zero-width characters for which to reserve space. */
@@ -1749,6 +2202,36 @@ char *display_string(const char *text, size_t column, size_t span,
 	size_t beyond = column + span;
 		/* The column number just beyond the last shown character. */
 
+#ifndef NANO_TINY
+	/* On a long line, start looking from the nearest checkpoint. */
+	if (column >= LONG_LINE)
+		start_x = nearest_checkpoint(text, (size_t)-1, column, &start_col);
+#endif
+
+	/* Find the first character to show, and the column where it starts,
+	 * in a single walk, instead of first its index and then its column. */
+	while (text[start_x] != '\0') {
+		/* Step over plain ASCII in one go, as far as the column allows. */
+		size_t run = ascii_run(text + start_x, column - start_col);
+		size_t width;
+		int charlen;
+
+		start_x += run;
+		start_col += run;
+
+		if (text[start_x] == '\0')
+			break;
+
+		width = start_col;
+		charlen = advance_over(text + start_x, &width);
+
+		if (width > column)
+			break;
+
+		start_x += charlen;
+		start_col = width;
+	}
+
 	text += start_x;
 
 #ifndef NANO_TINY
@@ -1970,6 +2453,10 @@ void titlebar(const char *path)
 	char *ranking = NULL;
 		/* The buffer sequence number plus the total buffer count. */
 
+#ifndef NANO_TINY
+	bars_drawn++;
+#endif
+
 	/* If the screen is too small, there is no title bar. */
 	if (topwin == NULL)
 		return;
@@ -2120,6 +2607,8 @@ void minibar(void)
 	wchar_t widecode;
 #endif
 
+	bars_drawn++;
+
 	/* Draw a colored bar over the full width of the screen. */
 	wattron(bottomwin, interface_color_pair[MINI_INFOBAR]);
 	mvwprintw(bottomwin, 0, 0, "%*s", COLS, " ");
@@ -2393,6 +2882,10 @@ void bottombars(int menu)
 	const keystruct *s;
 	funcstruct *f;
 
+#ifndef NANO_TINY
+	bars_drawn++;
+#endif
+
 	/* Set the global variable to the given menu. */
 	currmenu = menu;
 
@@ -2482,6 +2975,102 @@ void place_the_cursor(void)
 	openfile->current_y = row;
 }
 
+/* Forget what all rows of the edit window show, so they will all be redrawn. */
+void invalidate_rows(void)
+{
+	if (rowmap_size != editwinrows) {
+		rowmap = nrealloc(rowmap, editwinrows * sizeof(rowstruct));
+		rowmap_size = editwinrows;
+	}
+
+	for (int row = 0; row < rowmap_size; row++)
+		rowmap[row].line = NULL;
+}
+
+/* Forget what the given row of the edit window shows. */
+void forget_row(int row)
+{
+	if (row >= 0 && row < rowmap_size)
+		rowmap[row].line = NULL;
+}
+
+/* Return a hash of the given text (FNV-1a), to notice changes cheaply. */
+size_t fingerprint_of(const char *text)
+{
+	size_t hash = (sizeof(size_t) > 4) ? (size_t)14695981039346656037ULL : 2166136261U;
+	size_t prime = (sizeof(size_t) > 4) ? (size_t)1099511628211ULL : 16777619U;
+
+	while (*text != '\0')
+		hash = (hash ^ (unsigned char)*text++) * prime;
+
+	return hash;
+}
+
+/* Return TRUE when the given row already shows the piece of the given line
+ * that starts at from_col exactly as it would be drawn now. */
+bool row_is_up_to_date(int row, const linestruct *line, size_t from_col,
+						size_t fingerprint)
+{
+	const rowstruct *shown;
+
+	if (row < 0 || row >= rowmap_size || rowmap[row].line != line)
+		return FALSE;
+
+	shown = &rowmap[row];
+
+#ifndef NANO_TINY
+	/* A marked region or a spotlighted match makes a row special. */
+	if (openfile->mark || (spotlighted && line == openfile->current))
+		return FALSE;
+#endif
+
+	return (shown->buffer == openfile && shown->lineno == line->lineno &&
+#ifdef ENABLE_COLOR
+			shown->syntax == openfile->syntax &&
+			shown->multidata == line->multidata &&
+			shown->priordata == (line->prev ? line->prev->multidata : 0) &&
+#endif
+#ifndef NANO_TINY
+			shown->anchored == line->has_anchor &&
+#endif
+			shown->from_col == from_col && shown->fingerprint == fingerprint);
+}
+
+/* Note down what the given row of the edit window now shows -- unless how it
+ * looks depends on more than the line itself and the state of the line before. */
+void remember_row(int row, const linestruct *line, size_t from_col,
+						size_t fingerprint)
+{
+	rowstruct *shown;
+
+	if (row < 0 || row >= rowmap_size)
+		return;
+
+	shown = &rowmap[row];
+	shown->line = NULL;
+
+#ifndef NANO_TINY
+	if (openfile->mark)
+		return;
+#endif
+#ifdef ENABLE_COLOR
+	if (coloring_curtailed || !colored_by_itself(line, row == 0))
+		return;
+
+	shown->syntax = openfile->syntax;
+	shown->multidata = line->multidata;
+	shown->priordata = (line->prev ? line->prev->multidata : 0);
+#endif
+#ifndef NANO_TINY
+	shown->anchored = line->has_anchor;
+#endif
+	shown->buffer = openfile;
+	shown->line = line;
+	shown->lineno = line->lineno;
+	shown->from_col = from_col;
+	shown->fingerprint = fingerprint;
+}
+
 /* Draw the given text on the given row of the edit window.  line is the
  * line to be drawn, and converted is the actual string to be written with
  * tabs and control characters replaced by strings of regular characters.
@@ -2514,6 +3103,13 @@ void draw_row(int row, const char *converted, linestruct *line, size_t from_col)
 	}
 #endif /* ENABLE_LINENUMBERS */
 
+#ifndef NANO_TINY
+	rows_drawn++;
+
+	if (dispatched > 0)
+		painted = nanoseconds_now();
+#endif
+
 	/* First simply write the converted line -- afterward we'll add colors
 	 * and the marking highlight on just the pieces that need it. */
 	mvwaddstr(edit, row, margin, converted);
@@ -2531,10 +3127,26 @@ void draw_row(int row, const char *converted, linestruct *line, size_t from_col)
 	/* If there are color rules (and coloring is turned on), apply them. */
 	if (openfile->syntax && !ISSET(NO_SYNTAX)) {
 		const colortype *varnish = openfile->syntax->color;
-
-		/* If there are multiline regexes, make sure this line has a cache. */
-		if (openfile->syntax->nmultis > 0 && line->multidata == NULL)
-			line->multidata = nmalloc(openfile->syntax->nmultis * sizeof(short));
+		const char *window = line->data;
+			/* The text that the single-line regexes get to see. */
+		int window_flags = 0;
+			/* Whether that text stops short of the end of the line. */
+		char *excerpt = NULL;
+
+		/* For an overlong line, do not let the single-line regexes search
+		 * much beyond the visible part.  (What comes before it must still
+		 * be searched, as it determines where matches begin and end.) */
+		if (strnlen(line->data + till_x, COLORING_MARGIN + 1) > COLORING_MARGIN) {
+			size_t window_end = till_x + COLORING_MARGIN;
+
+			/* Do not cut any multibyte character in two. */
+			while ((line->data[window_end] & 0xC0) == 0x80)
+				window_end++;
+
+			excerpt = measured_copy(line->data, window_end);
+			window = excerpt;
+			window_flags = REG_NOTEOL;
+		}
 
 		/* Iterate through all the coloring regexes. */
 		for (; varnish != NULL; varnish = varnish->next) {
@@ -2555,12 +3167,24 @@ void draw_row(int row, const char *converted, linestruct *line, size_t from_col)
 			regmatch_t startmatch, endmatch;
 				/* The match positions of the start and end regexes. */
 
+			if (colorprofile != NULL)
+				time_rule(varnish, PAINTING);
+
+			/* When coloring has taken too long, show the line as plain text. */
+			if (colorbudget > 0 && clock() > color_deadline) {
+				mvwaddstr(edit, row, margin, converted);
+				if (!coloring_curtailed)
+					statusline(INFO, _("Coloring takes too long; showing plain text"));
+				coloring_curtailed = TRUE;
+				break;
+			}
+
 			/* First case: varnish is a single-line expression. */
 			if (varnish->end == NULL) {
 				while (index < till_x) {
 					/* If there is no match, go on to the next line. */
-					if (regexec(varnish->start, &line->data[index], 1,
-								&match, (index == 0) ? 0 : REG_NOTBOL) != 0)
+					if (regexec(varnish->start, window + index, 1, &match,
+								((index == 0) ? 0 : REG_NOTBOL) | window_flags) != 0)
 						break;
 
 					/* Translate the match to the beginning of the line. */
@@ -2603,18 +3227,16 @@ void draw_row(int row, const char *converted, linestruct *line, size_t from_col)
 			/* Second case: varnish is a multiline expression. */
 
 			/* Assume nothing gets painted until proven otherwise below. */
-			line->multidata[varnish->id] = NOTHING;
+			set_multistate(line, varnish, NOTHING);
 
 			/* Apart from the first row, check the multidata of the preceding line:
 			 * it tells us about the situation so far, and thus what to do here. */
-			if (row > 0 && start_line != NULL && start_line->multidata != NULL) {
-				if (start_line->multidata[varnish->id] == WHOLELINE ||
-						start_line->multidata[varnish->id] == STARTSHERE ||
-						start_line->multidata[varnish->id] == WOULDBE)
+			if (row > 0 && start_line != NULL) {
+				short state = multistate(start_line, varnish);
+
+				if (state == WHOLELINE || state == STARTSHERE || state == WOULDBE)
 					goto seek_an_end;
-				if (start_line->multidata[varnish->id] == NOTHING ||
-						start_line->multidata[varnish->id] == ENDSHERE ||
-						start_line->multidata[varnish->id] == JUSTONTHIS)
+				if (state == NOTHING || state == ENDSHERE || state == JUSTONTHIS)
 					goto step_two;
 			}
 
@@ -2629,6 +3251,13 @@ void draw_row(int row, const char *converted, linestruct *line, size_t from_col)
 				 * there is no need to look for starts on earlier lines. */
 				if (regexec(varnish->end, start_line->data, 0, NULL, 0) == 0)
 					goto step_two;
+				/* At a checkpoint, the recorded state tells what came before. */
+				if (start_line->lineno % CHECKPOINT_STRIDE == 1) {
+					if (unpaired_at_checkpoint(varnish, start_line))
+						goto seek_an_end;
+					else
+						goto step_two;
+				}
 				start_line = start_line->prev;
 			}
 
@@ -2637,9 +3266,8 @@ void draw_row(int row, const char *converted, linestruct *line, size_t from_col)
 				goto step_two;
 
 			/* If the start has been qualified as an end earlier, believe it. */
-			if (start_line->multidata != NULL &&
-						(start_line->multidata[varnish->id] == ENDSHERE ||
-						start_line->multidata[varnish->id] == JUSTONTHIS))
+			if (multistate(start_line, varnish) == ENDSHERE ||
+						multistate(start_line, varnish) == JUSTONTHIS)
 				goto step_two;
 
 			/* Maybe there is an end on that same line?  If yes, maybe
@@ -2679,14 +3307,14 @@ void draw_row(int row, const char *converted, linestruct *line, size_t from_col)
 
 			/* If there is no end, there is nothing to paint. */
 			if (end_line == NULL) {
-				line->multidata[varnish->id] = WOULDBE;
+				set_multistate(line, varnish, WOULDBE);
 				continue;
 			}
 
 			/* If it was already determined that there is no end... */
-			if (end_line != line && line->prev == start_line && line->prev->multidata &&
-								line->prev->multidata[varnish->id] == WOULDBE) {
-				line->multidata[varnish->id] = WOULDBE;
+			if (end_line != line && line->prev == start_line &&
+								multistate(line->prev, varnish) == WOULDBE) {
+				set_multistate(line, varnish, WOULDBE);
 				continue;
 			}
 
@@ -2695,7 +3323,7 @@ void draw_row(int row, const char *converted, linestruct *line, size_t from_col)
 				wattron(edit, varnish->attributes);
 				mvwaddnstr(edit, row, margin, converted, -1);
 				wattroff(edit, varnish->attributes);
-				line->multidata[varnish->id] = WHOLELINE;
+				set_multistate(line, varnish, WHOLELINE);
 				continue;
 			}
 
@@ -2707,7 +3335,7 @@ void draw_row(int row, const char *converted, linestruct *line, size_t from_col)
 				mvwaddnstr(edit, row, margin, converted, paintlen);
 				wattroff(edit, varnish->attributes);
 			}
-			line->multidata[varnish->id] = ENDSHERE;
+			set_multistate(line, varnish, ENDSHERE);
 
   step_two:
 			/* Second step: look for starts on this line, but begin
@@ -2740,7 +3368,7 @@ void draw_row(int row, const char *converted, linestruct *line, size_t from_col)
 						mvwaddnstr(edit, row, margin + start_col, thetext, paintlen);
 						wattroff(edit, varnish->attributes);
 
-						line->multidata[varnish->id] = JUSTONTHIS;
+						set_multistate(line, varnish, JUSTONTHIS);
 					}
 					index = endmatch.rm_eo;
 					/* If both start and end match are anchors, advance. */
@@ -2762,7 +3390,7 @@ void draw_row(int row, const char *converted, linestruct *line, size_t from_col)
 
 				/* If there is no end, we're done with this regex. */
 				if (end_line == NULL) {
-					line->multidata[varnish->id] = WOULDBE;
+					set_multistate(line, varnish, WOULDBE);
 					break;
 				}
 
@@ -2771,18 +3399,18 @@ void draw_row(int row, const char *converted, linestruct *line, size_t from_col)
 				mvwaddnstr(edit, row, margin + start_col, thetext, -1);
 				wattroff(edit, varnish->attributes);
 
-				line->multidata[varnish->id] = STARTSHERE;
+				set_multistate(line, varnish, STARTSHERE);
 
-				if (end_line->multidata == NULL) {
-					end_line->multidata = nmalloc(openfile->syntax->nmultis * sizeof(short));
-					for (short item = 0; item < openfile->syntax->nmultis; item++)
-						end_line->multidata[item] = 0;
-				}
-				end_line->multidata[varnish->id] = ENDSHERE;
+				set_multistate(end_line, varnish, ENDSHERE);
 
 				break;
 			}
 		}
+
+		if (colorprofile != NULL)
+			time_rule(NULL, PAINTING);
+
+		free(excerpt);
 	}
 #endif /* ENABLE_COLOR */
 
@@ -2877,7 +3505,18 @@ int update_line(linestruct *line, size_t index)
 		/* The data of the line with tabs and control characters expanded. */
 	size_t from_col;
 		/* From which column a horizontally scrolled line is displayed. */
+	size_t fingerprint;
+		/* A hash of the text of the line, to see whether it changed. */
+	bool hashable;
+		/* Whether the line is short enough to be worth hashing. */
 
+#ifdef ENABLE_COLOR
+	/* When not part of a full refresh, this line gets a budget of its own. */
+	if (!amid_refresh) {
+		color_deadline = clock() + colorbudget * (CLOCKS_PER_SEC / 1000);
+		coloring_curtailed = FALSE;
+	}
+#endif
 #ifndef NANO_TINY
 	if (ISSET(SOFTWRAP))
 		return update_softwrapped_line(line);
@@ -2888,6 +3527,15 @@ int update_line(linestruct *line, size_t index)
 	row = line->lineno - openfile->edittop->lineno;
 	from_col = get_page_start(wideness(line->data, index));
 
+	/* Hashing a long line costs more than drawing the one row it gets,
+	 * so such a line is simply redrawn each time. */
+	hashable = (strnlen(line->data, LONG_LINE) < LONG_LINE);
+	fingerprint = (hashable) ? fingerprint_of(line->data) : 0;
+
+	/* When the row shows this line already, there is nothing to do. */
+	if (hashable && row_is_up_to_date(row, line, from_col, fingerprint))
+		return 1;
+
 	/* Expand the piece to be drawn to its representable form, and draw it. */
 	converted = display_string(line->data, from_col, editwincols, TRUE, FALSE);
 	draw_row(row, converted, line, from_col);
@@ -2904,6 +3552,11 @@ int update_line(linestruct *line, size_t index)
 		wattroff(edit, hilite_attribute);
 	}
 
+	if (hashable)
+		remember_row(row, line, from_col, fingerprint);
+	else
+		forget_row(row);
+
 	if (spotlighted && line == openfile->current)
 		spotlight(light_from_col, light_to_col);
 
@@ -2930,6 +3583,10 @@ int update_softwrapped_line(linestruct *line)
 		/* The data of the chunk with tabs and control characters expanded. */
 	bool end_of_line = FALSE;
 		/* Becomes TRUE when the last chunk of the line has been reached. */
+	bool hashable = (strnlen(line->data, LONG_LINE) < LONG_LINE);
+		/* Whether the line is short enough to be worth hashing. */
+	size_t fingerprint = (hashable) ? fingerprint_of(line->data) : 0;
+		/* A hash of the text of the line, to see whether it changed. */
 
 	if (line == openfile->edittop)
 		from_col = openfile->firstcolumn;
@@ -2952,16 +3609,26 @@ int update_softwrapped_line(linestruct *line)
 	starting_row = row;
 
 	while (!end_of_line && row < editwinrows) {
-		to_col = get_softwrap_breakpoint(line->data, from_col, &end_of_line);
+		to_col = get_softwrap_breakpoint(line, from_col, &end_of_line);
 
 		sequel_column = (end_of_line) ? 0 : to_col;
 
-		/* Convert the chunk to its displayable form and draw it. */
-		converted = display_string(line->data, from_col, to_col - from_col,
-									TRUE, FALSE);
-		draw_row(row++, converted, line, from_col);
-		free(converted);
+		/* Convert the chunk to its displayable form and draw it,
+		 * unless the row shows this chunk already.  A long line is
+		 * not hashed, as that costs more than redrawing its rows. */
+		if (!hashable || !row_is_up_to_date(row, line, from_col, fingerprint)) {
+			converted = display_string(line->data, from_col, to_col - from_col,
+										TRUE, FALSE);
+			draw_row(row, converted, line, from_col);
+			free(converted);
+
+			if (hashable)
+				remember_row(row, line, from_col, fingerprint);
+			else
+				forget_row(row);
+		}
 
+		row++;
 		from_col = to_col;
 	}
 
@@ -3038,7 +3705,7 @@ int go_forward_chunks(int nrows, linestruct **line, size_t *leftedge)
 		for (i = nrows; i > 0; i--) {
 			bool end_of_line = FALSE;
 
-			current_leftedge = get_softwrap_breakpoint((*line)->data,
+			current_leftedge = get_softwrap_breakpoint(*line,
 										current_leftedge, &end_of_line);
 
 			if (!end_of_line)
@@ -3081,6 +3748,192 @@ bool less_than_a_screenful(size_t was_lineno, size_t was_leftedge)
 }
 
 #ifndef NANO_TINY
+/* Return a number that changes whenever the width of the edit window, the
+ * tab size, or the way of softwrapping changes -- the things that determine
+ * how many rows a line takes. */
+static size_t current_layout(void)
+{
+	return ((size_t)editwincols * 256 + tabsize) * 2 + (ISSET(AT_BLANKS) ? 1 : 0);
+}
+
+/* Add the given number of rows to the count of the given block of lines. */
+static void adjust_row_tree(size_t block, ssize_t amount)
+{
+	for (size_t index = block + 1; index <= openfile->rowblocks; index += index & -index)
+		openfile->rowtree[index] += amount;
+}
+
+/* Return how many rows the blocks of lines before the given block take. */
+static size_t rows_in_blocks_before(size_t block)
+{
+	size_t rows = 0;
+
+	for (size_t index = block; index > 0; index -= index & -index)
+		rows += openfile->rowtree[index];
+
+	return rows;
+}
+
+/* Store the given number of rows as the count of the given block (one-based),
+ * adding the entries that the tree entry for this block spans.  The entries
+ * for the preceding blocks must be correct. */
+static void set_row_block(size_t index, size_t rows)
+{
+	for (size_t step = 1; step < (index & -index); step <<= 1)
+		rows += openfile->rowtree[index - step];
+
+	openfile->rowtree[index] = rows;
+}
+
+/* Bring the row tree of the current buffer up to date: recount the lines
+ * whose count is unknown, and redo the sums for the blocks after the last
+ * valid one.  The tree entries for the valid blocks remain correct. */
+static void update_row_tree(void)
+{
+	size_t blocks = (openfile->filebot->lineno - 1) / ROWCOUNT_STRIDE + 1;
+	linestruct *line;
+
+	/* When the width or the tab size changed, every line needs recounting. */
+	if (openfile->rowlayout != current_layout()) {
+		for (line = openfile->filetop; line != NULL; line = line->next)
+			line->extrarows = -1;
+
+		openfile->rowlayout = current_layout();
+		openfile->rowsvalid = 0;
+	}
+
+	/* As the magic line comes and goes without a renumbering, always redo
+	 * the last block.  It is short, and most of its lines have known counts. */
+	if (openfile->rowsvalid > blocks - 1)
+		openfile->rowsvalid = blocks - 1;
+
+	if (openfile->rowblocks != blocks)
+		openfile->rowtree = nrealloc(openfile->rowtree, (blocks + 1) * sizeof(size_t));
+
+	/* When only the last block needs redoing, reach it from the end. */
+	if (openfile->rowsvalid < blocks - 1)
+		line = line_from_number(openfile->rowsvalid * ROWCOUNT_STRIDE + 1);
+	else {
+		line = openfile->filebot;
+		while (line->lineno > (ssize_t)(openfile->rowsvalid * ROWCOUNT_STRIDE + 1))
+			line = line->prev;
+	}
+
+	for (size_t index = openfile->rowsvalid + 1; index <= blocks; index++) {
+		size_t rows = 0;
+
+		for (int count = 0; count < ROWCOUNT_STRIDE && line != NULL; count++) {
+			if (line->extrarows < 0)
+				line->extrarows = extra_chunks_in(line);
+
+			rows += 1 + line->extrarows;
+			line = line->next;
+		}
+
+		set_row_block(index, rows);
+	}
+
+	openfile->rowblocks = blocks;
+	openfile->rowsvalid = blocks;
+}
+
+/* Return on which row (counting from the top of the buffer, zero-based)
+ * the given line begins.  The row tree must be up to date. */
+static size_t rows_before(const linestruct *line)
+{
+	size_t block = (line->lineno - 1) / ROWCOUNT_STRIDE;
+	size_t rows = rows_in_blocks_before(block);
+
+	for (line = line->prev; line != NULL && line->lineno > block * ROWCOUNT_STRIDE;
+												line = line->prev)
+		rows += 1 + line->extrarows;
+
+	return rows;
+}
+
+/* Recount the rows that the lines from top to bot take, as their text
+ * has changed, and adjust the row tree accordingly. */
+void recount_rows(linestruct *top, const linestruct *bot)
+{
+	forget_layout_of(top, bot);
+
+	if (openfile->rowtree == NULL || openfile->rowlayout != current_layout())
+		return;
+
+	while (TRUE) {
+		size_t block = (top->lineno - 1) / ROWCOUNT_STRIDE;
+		int extras = extra_chunks_in(top);
+
+		if (top->extrarows >= 0 && block < openfile->rowsvalid)
+			adjust_row_tree(block, extras - top->extrarows);
+
+		top->extrarows = extras;
+
+		if (top == bot || top->next == NULL)
+			break;
+
+		top = top->next;
+	}
+}
+
+/* Renumber the lines from the given line onward, as lines were added or
+ * removed there, and meanwhile redo the row counts of the blocks from there
+ * on, as each of them has shifted.  The lines keep their own counts, except
+ * the given line and the one before it, as these may have been split or
+ * joined.  Return FALSE when the buffer has no row tree to keep up to date,
+ * meaning that the caller should do the renumbering. */
+bool renumber_and_recount(linestruct *line)
+{
+	linestruct *start = (line->prev != NULL) ? line->prev : line;
+	size_t block = (start == line) ? 0 : (start->lineno - 1) / ROWCOUNT_STRIDE;
+	size_t index = block + 1, rows = 0;
+	ssize_t number = block * ROWCOUNT_STRIDE;
+
+	/* Lines may have been split, joined, or swapped. */
+	forget_layout_of(NULL, NULL);
+
+	if (openfile->rowtree == NULL)
+		return FALSE;
+
+	line->extrarows = -1;
+	start->extrarows = -1;
+
+	/* When the tree is incomplete anyway, leave the counting for later. */
+	if (openfile->rowlayout != current_layout() || openfile->rowsvalid < block) {
+		if (block < openfile->rowsvalid)
+			openfile->rowsvalid = block;
+		return FALSE;
+	}
+
+	/* Step back to the first line of the block. */
+	while (start->prev != NULL && start->lineno > number + 1)
+		start = start->prev;
+
+	for (line = start; line != NULL; line = line->next) {
+		line->lineno = ++number;
+
+		if (line->extrarows < 0)
+			line->extrarows = extra_chunks_in(line);
+
+		rows += 1 + line->extrarows;
+
+		if (number % ROWCOUNT_STRIDE == 0 || line->next == NULL) {
+			if (index > openfile->rowblocks) {
+				openfile->rowtree = nrealloc(openfile->rowtree, (index + 1) * sizeof(size_t));
+				openfile->rowblocks = index;
+			}
+
+			set_row_block(index++, rows);
+			rows = 0;
+		}
+	}
+
+	openfile->rowblocks = index - 1;
+	openfile->rowsvalid = index - 1;
+
+	return TRUE;
+}
+
 /* Draw a scroll bar on the righthand side of the screen. */
 void draw_scrollbar(void)
 {
@@ -3088,16 +3941,12 @@ void draw_scrollbar(void)
 	int fromline = openfile->edittop->lineno - 1;
 	int coveredlines = editwinrows;
 
+	/* When softwrapping, measure in screen rows instead of in lines. */
 	if (ISSET(SOFTWRAP)) {
-		linestruct *line = openfile->edittop;
-		int extras = extra_chunks_in(line) - chunk_for(openfile->firstcolumn, line);
-
-		while (line->lineno + extras < fromline + editwinrows && line->next) {
-			line = line->next;
-			extras += extra_chunks_in(line);
-		}
-
-		coveredlines = line->lineno - fromline;
+		update_row_tree();
+		totallines = rows_in_blocks_before(openfile->rowblocks);
+		fromline = rows_before(openfile->edittop) +
+						chunk_for(openfile->firstcolumn, openfile->edittop);
 	}
 
 	int lowest = (fromline * editwinrows) / totallines;
@@ -3122,6 +3971,10 @@ void edit_scroll(bool direction)
 	size_t leftedge;
 	int nrows = 1;
 
+#ifndef NANO_TINY
+	rows_scrolled++;
+#endif
+
 	/* Move the top line of the edit window one row up or down. */
 	if (direction == BACKWARD)
 		go_back_chunks(1, &openfile->edittop, &openfile->firstcolumn);
@@ -3133,6 +3986,16 @@ void edit_scroll(bool direction)
 	wscrl(edit, (direction == BACKWARD) ? -1 : 1);
 	scrollok(edit, FALSE);
 
+	/* Let the knowledge of what each row shows move along. */
+	if (rowmap_size > 1 && direction == BACKWARD) {
+		memmove(rowmap + 1, rowmap, (rowmap_size - 1) * sizeof(rowstruct));
+		forget_row(0);
+	} else if (rowmap_size > 1) {
+		memmove(rowmap, rowmap + 1, (rowmap_size - 1) * sizeof(rowstruct));
+		forget_row(rowmap_size - 1);
+	} else
+		forget_row(0);
+
 	/* If we're not on the first "page" (when not softwrapping), or the mark
 	 * is on, the row next to the scrolled region needs to be redrawn too. */
 	if (line_needs_update(openfile->placewewant, 0) && nrows < editwinrows)
@@ -3170,19 +4033,18 @@ void edit_scroll(bool direction)
 }
 
 #ifndef NANO_TINY
-/* Get the column number after leftedge where we can break the given text, and
- * return it.  This will always be editwincols or less after leftedge.  Set
- * end_of_line to TRUE if we reach the end of the line while searching the
- * text.  Assume leftedge is the leftmost column of a softwrapped chunk. */
-size_t get_softwrap_breakpoint(const char *text, size_t leftedge,
+/* Get the column number after leftedge where we can break the given text,
+ * where the text starts at the given column, and return it.  This will always
+ * be editwincols or less after leftedge.  Set end_of_line to TRUE if we reach
+ * the end of the line while searching the text.  Assume leftedge is the
+ * leftmost column of a softwrapped chunk. */
+size_t find_breakpoint(const char *text, size_t column, size_t leftedge,
 								bool *end_of_line)
 {
 	size_t goal_column = leftedge + editwincols;
 		/* The place at or before which text must be broken. */
 	size_t breaking_col = goal_column;
 		/* The column where text can be broken, when there's no better. */
-	size_t column = 0;
-		/* Current column position in text. */
 	size_t last_blank_col = 0;
 		/* The column position of the last seen whitespace character. */
 	const char *farthest_blank = NULL;
@@ -3228,16 +4090,144 @@ size_t get_softwrap_breakpoint(const char *text, size_t leftedge,
 	return (editwincols > 1) ? breaking_col : column - 1;
 }
 
+/* Forget the chunk maps and the column indexes of the lines from top to bot,
+ * or of all lines when top is NULL, because their text has changed. */
+void forget_layout_of(const linestruct *top, const linestruct *bot)
+{
+	for (chunkmapstruct *map = chunkmaps; map < chunkmaps + CHUNKMAPS; map++)
+		if (map->line != NULL && (top == NULL || map->line == top ||
+					(top->lineno <= map->line->lineno &&
+					map->line->lineno <= bot->lineno)))
+			map->line = NULL;
+
+	forget_column_indexes(top, bot);
+}
+
+/* Forget the chunk map of the given line, and keep from its column index
+ * just the checkpoints up to the given offset, where the line was edited. */
+void trim_layout_of(const linestruct *line, size_t offset)
+{
+	for (chunkmapstruct *map = chunkmaps; map < chunkmaps + CHUNKMAPS; map++)
+		if (map->line == line)
+			map->line = NULL;
+
+	trim_column_index(line, offset);
+}
+
+/* Return the chunk map for the given line, computing it when the line is not
+ * among the recently mapped ones, or NULL when the line is too short to bother:
+ * a line of less than a few screen widths is quicker to just walk. */
+chunkmapstruct *chunk_map_for(const linestruct *line)
+{
+	static int victim = 0;
+	size_t column = 0, leftedge = 0;
+	const char *text = line->data;
+	bool end_of_line = FALSE;
+	chunkmapstruct *map;
+	size_t room = 32;
+
+	/* The map of an edited line has been forgotten, so when the line and
+	 * the layout are the same, the chunks are the same. */
+	for (map = chunkmaps; map < chunkmaps + CHUNKMAPS; map++)
+		if (map->line == line && map->text == line->data && map->width == editwincols &&
+					map->tabsize == tabsize && map->at_blanks == ISSET(AT_BLANKS))
+			return map;
+
+	if (strnlen(line->data, 4 * editwincols) < 4 * editwincols)
+		return NULL;
+
+	/* Otherwise, recycle the entries in turn. */
+	map = chunkmaps + victim;
+	victim = (victim + 1) % CHUNKMAPS;
+
+	map->line = line;
+	map->text = line->data;
+	map->width = editwincols;
+	map->tabsize = tabsize;
+	map->at_blanks = ISSET(AT_BLANKS);
+	map->count = 0;
+
+	map->leftedges = nrealloc(map->leftedges, room * sizeof(size_t));
+
+	/* Walk the line just once, noting where each chunk starts. */
+	while (!end_of_line) {
+		while (*text != '\0' && column < leftedge)
+			text += advance_over(text, &column);
+
+		if (map->count + 1 == room) {
+			room *= 2;
+			map->leftedges = nrealloc(map->leftedges, room * sizeof(size_t));
+		}
+
+		map->leftedges[map->count++] = leftedge;
+
+		leftedge = find_breakpoint(text, column, leftedge, &end_of_line);
+	}
+
+	/* After the last chunk, store where it ends. */
+	map->leftedges[map->count] = leftedge;
+
+	return map;
+}
+
+/* Return the index of the last chunk in the given map that starts at or
+ * before the given column. */
+size_t chunk_in_map(const chunkmapstruct *map, size_t column)
+{
+	size_t low = 0, high = map->count - 1;
+
+	while (low < high) {
+		size_t middle = (low + high + 1) / 2;
+
+		if (map->leftedges[middle] <= column)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+
+	return low;
+}
+
+/* Get the column number after leftedge where we can break the text of the
+ * given line, and return it.  This will always be editwincols or less after
+ * leftedge.  Set end_of_line to TRUE if we reach the end of the line while
+ * searching the text.  Assume leftedge is the leftmost column of a chunk. */
+size_t get_softwrap_breakpoint(const linestruct *line, size_t leftedge,
+								bool *end_of_line)
+{
+	chunkmapstruct *map = chunk_map_for(line);
+
+	if (map != NULL) {
+		size_t chunk = chunk_in_map(map, leftedge);
+
+		if (map->leftedges[chunk] == leftedge) {
+			*end_of_line = (chunk == map->count - 1);
+			return map->leftedges[chunk + 1];
+		}
+	}
+
+	return find_breakpoint(line->data, 0, leftedge, end_of_line);
+}
+
 /* Get the row of the softwrapped chunk of the given line that column is on,
  * relative to the first row (zero-based), and return it.  If leftedge isn't
  * NULL, return the leftmost column of the chunk in it. */
 size_t get_chunk_and_edge(size_t column, linestruct *line, size_t *leftedge)
 {
 	size_t current_chunk = 0, start_col = 0, end_col;
+	chunkmapstruct *map = chunk_map_for(line);
 	bool end_of_line = FALSE;
 
+	/* For a long line, look the chunk up instead of walking the line. */
+	if (map != NULL) {
+		current_chunk = chunk_in_map(map, column);
+		if (leftedge != NULL)
+			*leftedge = map->leftedges[current_chunk];
+		return current_chunk;
+	}
+
 	while (TRUE) {
-		end_col = get_softwrap_breakpoint(line->data, start_col, &end_of_line);
+		end_col = find_breakpoint(line->data, 0, start_col, &end_of_line);
 
 		/* We reached the end of the line and/or found column, so get out. */
 		if (end_of_line || (start_col <= column && column < end_col)) {
@@ -3300,7 +4290,7 @@ size_t actual_last_column(size_t leftedge, size_t column)
 #ifndef NANO_TINY
 	if (ISSET(SOFTWRAP)) {
 		bool last_chunk = FALSE;
-		size_t end_col = get_softwrap_breakpoint(openfile->current->data,
+		size_t end_col = get_softwrap_breakpoint(openfile->current,
 										leftedge, &last_chunk) - leftedge;
 
 		/* If we're not on the last chunk, we're one column past the end of
@@ -3427,6 +4417,13 @@ void edit_refresh(void)
 	clock_t start = clock();
 #endif
 
+#ifdef ENABLE_COLOR
+	/* All rows together get the budget for coloring. */
+	color_deadline = clock() + colorbudget * (CLOCKS_PER_SEC / 1000);
+	coloring_curtailed = FALSE;
+	amid_refresh = TRUE;
+#endif
+
 	line = openfile->edittop;
 
 	while (row < editwinrows && line != NULL) {
@@ -3437,13 +4434,17 @@ void edit_refresh(void)
 		line = line->next;
 	}
 
+#ifdef ENABLE_COLOR
+	amid_refresh = FALSE;
+#endif
+
 	while (row < editwinrows) {
 		blank_row(edit, row);
 #ifndef NANO_TINY
 		if (thebar)
 			mvwaddch(edit, row, COLS - 1, bardata[row]);
 #endif
-		row++;
+		forget_row(row++);
 	}
 
 #ifdef TIMEREFRESH
@@ -3454,8 +4455,30 @@ void edit_refresh(void)
 	wnoutrefresh(edit);
 
 	refresh_needed = FALSE;
+#ifndef NANO_TINY
+	painting_postponed = FALSE;
+
+	if (dispatched > 0)
+		painted = nanoseconds_now();
+#endif
 }
 
+#ifndef NANO_TINY
+/* Do the part of edit_refresh() that the handling of further keystrokes
+ * depends on -- bring the current line into view and determine the cursor
+ * position -- but leave the painting of the rows for later.  Any rows that
+ * get drawn in the meantime will simply be drawn again. */
+void postpone_refresh(void)
+{
+	if (current_is_offscreen())
+		adjust_viewport((focusing || ISSET(JUMPY_SCROLLING)) ? CENTERING : FLOWING);
+
+	place_the_cursor();
+
+	painting_postponed = TRUE;
+}
+#endif
+
 /* Move edittop so that current is on the screen.  manner says how:
  * STATIONARY means that the cursor should stay on the same screen row,
  * CENTERING means that current should end up in the middle of the screen,
@@ -3562,6 +4585,9 @@ void spotlight(size_t from_col, size_t to_col)
 		mvwaddch(edit, openfile->current_y, COLS - 1 - thebar, '>');
 	wattroff(edit, interface_color_pair[SPOTLIGHTED]);
 
+	/* The row will need a full redraw when the highlight goes away. */
+	forget_row(openfile->current_y);
+
 	free(word);
 }
 
@@ -3579,7 +4605,7 @@ void spotlight_softwrapped(size_t from_col, size_t to_col)
 	row = openfile->current_y;
 
 	while (row < editwinrows) {
-		break_col = get_softwrap_breakpoint(openfile->current->data,
+		break_col = get_softwrap_breakpoint(openfile->current,
 												leftedge, &end_of_line);
 
 		/* If the highlighting ends on this chunk, we can stop after it. */
@@ -3600,6 +4626,8 @@ void spotlight_softwrapped(size_t from_col, size_t to_col)
 		waddnstr(edit, word, actual_x(word, break_col));
 		wattroff(edit, interface_color_pair[SPOTLIGHTED]);
 
+		forget_row(row);
+
 		free(word);
 
 		if (end_of_line)